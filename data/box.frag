@@ -0,0 +1,6 @@
+#version 410 core
+// bounding box fragment shader for occlusion queries
+// only depth testing matters, so there is no color output
+
+void main() {
+}
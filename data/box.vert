@@ -0,0 +1,28 @@
+#version 410 core
+// bounding box vertex shader for occlusion queries
+
+// per-frame data, must match in C++ and any shaders that use it
+layout(std140)                          // standard layout matching C++
+uniform SceneData {                     // like a class name
+    mat4 ProjFromWorld, WorldFromProj;  // viewing matrices
+    vec4 LightDir;                      // light direction & ambient
+};
+
+// per-object data
+layout(std140)
+uniform ObjectData {
+    mat4 WorldFromModel, ModelFromWorld;    // object matrices
+    vec3 Ambient; float pad0;               // ambient color & padding
+    vec3 Diffuse; float pad1;               // diffuse color & padding
+    vec4 Specular;                          // specular color and exponent
+};
+
+// model-space box to draw
+uniform vec3 BoxMin, BoxMax;
+
+// corner of a unit cube
+layout (location = 0) in vec3 vPosition;
+
+void main() {
+    gl_Position = ProjFromWorld * (WorldFromModel * vec4(mix(BoxMin, BoxMax, vPosition), 1));
+}
@@ -1,14 +1,15 @@
 #version 410 core
-// simple object fragment shader
-
-// per-frame data, must match in C++ and any shaders that use it
-layout(std140)                          // standard layout matching C++
-uniform SceneData {                     // like a class name
-    mat4 ProjFromWorld, WorldFromProj;  // viewing matrices
-    vec4 LightDir;                      // light direction & ambient
-};
+// object fragment shader: G-buffer geometry pass
+// lighting happens later, once per pixel, in Passthrough.fragmentshader
 
 // per-object data
+#ifdef OBJECT_TEXELS
+// the same ObjectData as vec4 texels, after the two matrices
+uniform samplerBuffer ObjectTexels;
+flat in uint objectTexel;
+vec3 Ambient, Diffuse;
+vec4 Specular;
+#else
 layout(std140)
 uniform ObjectData {
     mat4 WorldFromModel, ModelFromWorld;    // object matrices
@@ -16,6 +17,7 @@ uniform ObjectData {
     vec3 Diffuse; float pad1;               // diffuse color & padding
     vec4 Specular;                          // specular color and exponent
 };
+#endif
 
 // global per-object setting, outside of a uniform block
 uniform sampler2D ColorTexture;
@@ -23,51 +25,68 @@ uniform sampler2D AmbientTexture;
 uniform sampler2D SpecularTexture;
 uniform sampler2D GlossTexture;
 
+// which maps are present, normally #defined true or false for each shader variant
+// otherwise detect the 1x1 placeholder texture for a missing map at run time
+#ifndef HAS_COLOR_MAP
+#define HAS_COLOR_MAP (textureSize(ColorTexture,0) != ivec2(1,1))
+#endif
+#ifndef HAS_AMBIENT_MAP
+#define HAS_AMBIENT_MAP (textureSize(AmbientTexture,0) != ivec2(1,1))
+#endif
+#ifndef HAS_SPECULAR_MAP
+#define HAS_SPECULAR_MAP (textureSize(SpecularTexture,0) != ivec2(1,1))
+#endif
+#ifndef HAS_GLOSS_MAP
+#define HAS_GLOSS_MAP (textureSize(GlossTexture,0) != ivec2(1,1))
+#endif
+
 // input (must match vertex shader output)
 in vec2 texcoord;  // texture coordinate
 in vec3 normal;    // world-space normal
-in vec4 position;  // world-space position
+#ifdef INSTANCED
+flat in vec3 instanceColor;     // per-instance diffuse color scale
+#endif
 
-// output to frame buffer
-out vec4 fragColor;
-layout (location = 0) out vec4 surfColOut;
-layout (location = 1) out vec4 normOut;
-layout (location = 2) out vec4 worldPosOut;
+// output to G-buffer attachments, packed to 8 or 10 bits per channel
+layout (location = 0) out vec4 surfColOut;  // diffuse color, encoded gloss
+layout (location = 1) out vec4 normOut;     // normal scaled to [0,1]
+layout (location = 2) out vec4 specColOut;  // specular color
+layout (location = 3) out vec4 ambColOut;   // ambient color
 
 void main() {
-    // lighting vectors
-    vec3 N = normalize(normal);             // surface normal
-    vec3 L = normalize(LightDir.xyz);       // light direction
-    vec3 V = normalize(WorldFromProj[3].xyz * position.w - position.xyz * WorldFromProj[3].w);
-    vec3 H = normalize(V+L);
-    float N_dot_L = max(0., dot(N, L));
-    float N_dot_H = max(0., dot(N, H));
+#ifdef OBJECT_TEXELS
+    int t = int(objectTexel);
+    Ambient = texelFetch(ObjectTexels, t+8).rgb;
+    Diffuse = texelFetch(ObjectTexels, t+9).rgb;
+    Specular = texelFetch(ObjectTexels, t+10);
+#endif
 
-    // ambient contribution
-    vec3 ambCol = Ambient * LightDir.a;
-    if (textureSize(AmbientTexture,0) != ivec2(1,1))
+    // ambient
+    vec3 ambCol = Ambient;
+    if (HAS_AMBIENT_MAP)
         ambCol *= texture(AmbientTexture, texcoord).rgb;
 
     // diffuse or texture
     vec3 diffCol = Diffuse;
-    if (textureSize(ColorTexture,0) != ivec2(1,1))
+#ifdef INSTANCED
+    diffCol *= instanceColor;
+#endif
+    if (HAS_COLOR_MAP)
         diffCol *= texture(ColorTexture, texcoord).rgb;
-    diffCol *= N_dot_L;
 
     // gloss/roughness
     float gloss = Specular.w;
-    if (textureSize(GlossTexture,0) != ivec2(1,1))
+    if (HAS_GLOSS_MAP)
         gloss *= texture(GlossTexture, texcoord).r;
 
     // specular
-    vec3 specCol = Specular.rgb * pow(N_dot_H, gloss) * N_dot_L;
-    if (textureSize(SpecularTexture,0) != ivec2(1,1))
+    vec3 specCol = Specular.rgb;
+    if (HAS_SPECULAR_MAP)
         specCol *= texture(SpecularTexture, texcoord).rgb;
 
-    // final color
-    fragColor = vec4(ambCol + diffCol + specCol, 1);
-
-    surfColOut = vec4(diffCol[0], diffCol[1], diffCol[2], gloss);
-    normOut = vec4(N.rgb[0], N.rgb[1], N.rgb[2], specCol[1]);
-    worldPosOut = vec4(position.rgb[0], position.rgb[1], position.rgb[2], ambCol[1]);
+    // gloss exponents up to 4095 in 8 bits, decoded in Passthrough.fragmentshader
+    surfColOut = vec4(diffCol, log2(gloss + 1.) / 12.);
+    normOut = vec4(0.5 * normalize(normal) + 0.5, 0);
+    specColOut = vec4(specCol, 0);
+    ambColOut = vec4(ambCol, 0);
 }
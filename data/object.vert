@@ -9,6 +9,13 @@ uniform SceneData {                     // like a class name
 };
 
 // per-object data
+#ifdef OBJECT_TEXELS
+// the same ObjectData as vec4 texels, starting at a texel given per draw
+uniform samplerBuffer ObjectTexels;
+layout (location = 3) in uint vObjectTexel;
+flat out uint objectTexel;
+mat4 WorldFromModel, ModelFromWorld;
+#else
 layout(std140)
 uniform ObjectData {
     mat4 WorldFromModel, ModelFromWorld;    // object matrices
@@ -16,6 +23,7 @@ uniform ObjectData {
     vec3 Diffuse; float pad1;               // diffuse color & padding
     vec4 Specular;                          // specular color and exponent
 };
+#endif
 
 // per-vertex input
 /*in vec2 vUV;        // vertex texture coordinate
@@ -25,20 +33,46 @@ layout (location = 0) in vec3 vPosition;
 layout (location = 1) in vec3 vNormal;
 layout (location = 2) in vec2 vUV;
 
+#ifdef INSTANCED
+// per-instance input: rotation, uniform scale, and translation, then color
+layout (location = 4) in mat4 vModelFromInstance;
+layout (location = 8) in vec4 vInstanceColor;
+flat out vec3 instanceColor;
+#endif
+
 // output (must match fragment shader input)
 out vec2 texcoord;  // texture coordinate
 out vec3 normal;    // world-space normal
 out vec4 position;  // world-space position
 
 void main() {
+#ifdef OBJECT_TEXELS
+    int t = int(vObjectTexel);
+    objectTexel = vObjectTexel;
+    WorldFromModel = mat4(texelFetch(ObjectTexels, t+0), texelFetch(ObjectTexels, t+1),
+                          texelFetch(ObjectTexels, t+2), texelFetch(ObjectTexels, t+3));
+    ModelFromWorld = mat4(texelFetch(ObjectTexels, t+4), texelFetch(ObjectTexels, t+5),
+                          texelFetch(ObjectTexels, t+6), texelFetch(ObjectTexels, t+7));
+#endif
+
     // just pass texture coordinate through
     texcoord = vUV;
 
+    // place this instance within the object
+#ifdef INSTANCED
+    vec4 modelPosition = vModelFromInstance * vec4(vPosition, 1);
+    vec3 modelNormal = mat3(vModelFromInstance) * vNormal;
+    instanceColor = vInstanceColor.rgb;
+#else
+    vec4 modelPosition = vec4(vPosition, 1);
+    vec3 modelNormal = vNormal;
+#endif
+
     // homogeneous transform of position to world space
-    position = WorldFromModel * vec4(vPosition, 1);
+    position = WorldFromModel * modelPosition;
 
     // 3x3 transform of normal to world space
-    normal = normalize(vNormal * mat3(ModelFromWorld));
+    normal = normalize(modelNormal * mat3(ModelFromWorld));
 
     // further transform world-space position to projection space
     gl_Position = ProjFromWorld * position;
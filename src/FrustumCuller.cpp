@@ -0,0 +1,123 @@
+// view frustum culling of bounding volumes, several at a time with SIMD
+
+#include "FrustumCuller.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUM_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+void FrustumCuller::setFrustum(const mat4 &ProjFromWorld)
+{
+    // Gribb/Hartmann: planes are sums and differences of matrix rows
+    mat4 rows = transpose(ProjFromWorld);
+    planes[0] = rows[3] + rows[0];      // left
+    planes[1] = rows[3] - rows[0];      // right
+    planes[2] = rows[3] + rows[1];      // bottom
+    planes[3] = rows[3] - rows[1];      // top
+    planes[4] = rows[3] + rows[2];      // near
+    planes[5] = rows[3] - rows[2];      // far
+    for (auto &plane : planes)
+        plane /= length(vec3(plane));
+}
+
+void FrustumCuller::clear()
+{
+    startTime = std::chrono::high_resolution_clock::now();
+    centerX.clear(); centerY.clear(); centerZ.clear(); radius.clear();
+    extentX.clear(); extentY.clear(); extentZ.clear();
+}
+
+int FrustumCuller::add(const vec3 &boundsMin, const vec3 &boundsMax,
+    const vec4 &sphere, const mat4 &WorldFromModel)
+{
+    // box center moves with the object, extent is the box of the rotated box
+    vec3 center = vec3(WorldFromModel * vec4(0.5f * (boundsMin + boundsMax), 1));
+    vec3 half = 0.5f * (boundsMax - boundsMin);
+    mat3 absM = mat3(abs(WorldFromModel[0]), abs(WorldFromModel[1]), abs(WorldFromModel[2]));
+    vec3 extent = absM * half;
+
+    // sphere radius grows by the largest scale
+    vec3 sphereCenter = vec3(WorldFromModel * vec4(vec3(sphere), 1));
+    float scale = max(max(length(vec3(WorldFromModel[0])), length(vec3(WorldFromModel[1]))),
+        length(vec3(WorldFromModel[2])));
+
+    // test uses the box center, so grow the sphere to be around that
+    float r = sphere.w * scale + length(sphereCenter - center);
+
+    int index = int(centerX.size());
+    centerX.push_back(center.x); centerY.push_back(center.y); centerZ.push_back(center.z);
+    radius.push_back(r);
+    extentX.push_back(extent.x); extentY.push_back(extent.y); extentZ.push_back(extent.z);
+    return index;
+}
+
+void FrustumCuller::test(std::vector<char> &visible)
+{
+    int count = int(centerX.size());
+    visible.resize(count);
+
+    // pad to a multiple of 4 with volumes that always pass
+    int padded = (count + 3) & ~3;
+    for (auto array : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ})
+        array->resize(padded, 0.f);
+    radius.resize(padded, INFINITY);
+
+    int i = 0;
+#ifdef FRUSTUM_SSE2
+    // four volumes against each plane at once
+    // outside a plane if the center is further behind it than the smaller
+    // of the sphere radius and the box's projected extent
+    __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (; i < padded; i += 4) {
+        __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+        __m128 r = _mm_loadu_ps(&radius[i]);
+        __m128 outside = _mm_setzero_ps();
+        for (auto &plane : planes) {
+            __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+                _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+            __m128 boxReach = _mm_add_ps(_mm_add_ps(
+                _mm_mul_ps(_mm_and_ps(nx, signMask), ex), _mm_mul_ps(_mm_and_ps(ny, signMask), ey)),
+                _mm_mul_ps(_mm_and_ps(nz, signMask), ez));
+            __m128 reach = _mm_min_ps(r, boxReach);
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(d, reach), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(outside);
+        for (int j=0; j < 4 && i + j < count; ++j)
+            visible[i + j] = !(mask & (1 << j));
+    }
+#endif
+
+    // scalar version of the same test
+    for (; i < count; ++i) {
+        bool outside = false;
+        for (auto &plane : planes) {
+            float d = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+            float boxReach = fabsf(plane.x) * extentX[i] + fabsf(plane.y) * extentY[i]
+                + fabsf(plane.z) * extentZ[i];
+            outside = outside || d + std::min(radius[i], boxReach) < 0.f;
+        }
+        visible[i] = !outside;
+    }
+
+    stats.tested = count;
+    stats.visible = int(std::count(visible.begin(), visible.end(), 1));
+    stats.culled = count - stats.visible;
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    stats.milliseconds = 1000 * elapsed.count();
+}
+
+void FrustumCuller::report(const char *label) const
+{
+    printf("%s: %d of %d visible, %d culled, %g ms per frame\n",
+        label, stats.visible, stats.tested, stats.culled, stats.milliseconds);
+}
@@ -0,0 +1,47 @@
+// view frustum culling of bounding volumes, several at a time with SIMD
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <chrono>
+
+class FrustumCuller {
+public:
+    // per-frame counts and time
+    struct Stats {
+        int tested, visible, culled;
+        double milliseconds;
+    } stats;
+
+    // frustum planes (xyz = inward normal, w = distance), from ProjFromWorld
+    glm::vec4 planes[6];
+
+private:
+    // world-space bounds, structure of arrays for SIMD, padded to a multiple of 4
+    // each volume has both a sphere (center and radius) and an AABB (center and extent)
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<float> extentX, extentY, extentZ;
+
+    std::chrono::high_resolution_clock::time_point startTime; // of clear, for stats
+
+public:
+    FrustumCuller() : stats{0, 0, 0, 0} {}
+
+    // set planes from a projection matrix
+    void setFrustum(const glm::mat4 &ProjFromWorld);
+
+    // start a new set of volumes to test
+    void clear();
+
+    // add a model-space AABB and bounding sphere, transformed to world space
+    // return index of this volume in test results
+    int add(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+        const glm::vec4 &sphere, const glm::mat4 &WorldFromModel);
+
+    // test all volumes added since clear against the frustum
+    // visible[i] is set to 1 if volume i may be visible, 0 if not
+    void test(std::vector<char> &visible);
+
+    // print stats for the last test
+    void report(const char *label) const;
+};
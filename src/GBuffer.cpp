@@ -0,0 +1,91 @@
+// deferred shading G-buffer: packed surface attributes and depth in one framebuffer
+
+#include "GBuffer.hpp"
+#include "GLState.hpp"
+
+#include <GL/glew.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+// storage for each color attachment, 4 bytes per pixel each
+//   ALBEDO: diffuse color and log-encoded gloss
+//   NORMAL: world-space normal, scaled to [0,1]
+//   SPECULAR: specular color
+//   AMBIENT: ambient color, before scene ambient intensity
+// positions are rebuilt from depth instead of stored
+static const GLenum colorFormats[GBuffer::NUM_COLORS] = {
+    GL_RGBA8, GL_RGB10_A2, GL_RGBA8, GL_RGBA8
+};
+static const size_t bytesPerPixel = 4 * GBuffer::NUM_COLORS + 4;   // plus 24-bit depth, 8 padding
+
+GBuffer::GBuffer()
+    : fbo(0), colorIDs{0}, depthID(0), width(0), height(0)
+{
+    glGenFramebuffers(1, &fbo);
+    glGenTextures(NUM_COLORS, colorIDs);
+    glGenTextures(1, &depthID);
+}
+
+GBuffer::~GBuffer()
+{
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(NUM_COLORS, colorIDs);
+    glDeleteTextures(1, &depthID);
+    GLState::global().deletedFramebuffer(fbo);
+    for (auto id : colorIDs)
+        GLState::global().deletedTexture(id);
+    GLState::global().deletedTexture(depthID);
+}
+
+void GBuffer::resize(int newWidth, int newHeight)
+{
+    // minimized windows have no size, so keep the old one
+    if (newWidth <= 0 || newHeight <= 0) return;
+    if (newWidth == width && newHeight == height) return;
+    width = newWidth;
+    height = newHeight;
+
+    // nearest filtering, since the lighting pass reads exactly one texel per pixel
+    GLState &state = GLState::global();
+    state.bindFramebuffer(GL_FRAMEBUFFER, fbo);
+    for (int i=0; i < NUM_COLORS; ++i) {
+        state.bindTexture(0, colorIDs[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, colorFormats[i], width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorIDs[i], 0);
+    }
+    state.bindTexture(0, depthID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthID, 0);
+
+    GLenum drawBuffers[NUM_COLORS];
+    for (int i=0; i < NUM_COLORS; ++i)
+        drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    glDrawBuffers(NUM_COLORS, drawBuffers);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        fprintf(stderr, "G-buffer framebuffer incomplete: 0x%x\n", status);
+    assert(status == GL_FRAMEBUFFER_COMPLETE);
+
+    printf("G-buffer %dx%d: %d bytes per pixel, %.2f MB\n", width, height,
+        int(bytesPerPixel), bytes() / (1024.f * 1024.f));
+}
+
+void GBuffer::bindTextures(int firstUnit) const
+{
+    GLState &state = GLState::global();
+    for (int i=0; i < NUM_COLORS; ++i)
+        state.bindTexture(firstUnit + i, colorIDs[i]);
+    state.bindTexture(firstUnit + NUM_COLORS, depthID);
+}
+
+size_t GBuffer::bytes() const
+{
+    return size_t(width) * height * bytesPerPixel;
+}
@@ -0,0 +1,28 @@
+// deferred shading G-buffer: packed surface attributes and depth in one framebuffer
+#pragma once
+
+#include <stddef.h>
+
+class GBuffer {
+public:
+    // color attachments, matching the outputs of object.frag
+    enum {ALBEDO, NORMAL, SPECULAR, AMBIENT, NUM_COLORS};
+
+    unsigned int fbo;                       // GL framebuffer object
+    unsigned int colorIDs[NUM_COLORS];      // GL textures for each attachment
+    unsigned int depthID;                   // GL depth texture, read to find positions
+    int width, height;                      // current size, 0 until first resize
+
+public:
+    GBuffer();
+    ~GBuffer();
+
+    // match the window size, reallocating only if it changed
+    void resize(int width, int height);
+
+    // bind color attachments to texture units from firstUnit, then depth after them
+    void bindTextures(int firstUnit) const;
+
+    // GPU memory for all attachments
+    size_t bytes() const;
+};
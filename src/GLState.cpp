@@ -0,0 +1,141 @@
+// tracks current GL bindings, so redundant bind calls can be skipped
+
+#include "GLState.hpp"
+
+#include <GL/glew.h>
+
+#include <stdio.h>
+#include <assert.h>
+
+GLState::GLState()
+    : frame{0,0}, lastFrame{0,0}, program(0), vertexArray(0), activeUnit(0),
+      drawFramebuffer(0), readFramebuffer(0)
+{
+    for (auto &texture : textures) texture = 0;
+    for (auto &texture : textureBuffers) texture = 0;
+    for (auto &uniform : uniforms) uniform = BufferRange{0, 0, 0};
+}
+
+GLState &GLState::global()
+{
+    // never destroyed, so it stays valid for other static objects
+    static GLState *state = new GLState;
+    return *state;
+}
+
+bool GLState::useProgram(unsigned int id)
+{
+    if (!count(id != program)) return false;
+    glUseProgram(id);
+    program = id;
+    return true;
+}
+
+bool GLState::bindVertexArray(unsigned int id)
+{
+    if (!count(id != vertexArray)) return false;
+    glBindVertexArray(id);
+    vertexArray = id;
+    return true;
+}
+
+bool GLState::bindTexture(int unit, unsigned int id)
+{
+    assert(unit >= 0 && unit < MAX_TEXTURE_UNITS);
+    if (!count(id != textures[unit])) return false;
+    activeTexture(unit);
+    glBindTexture(GL_TEXTURE_2D, id);
+    textures[unit] = id;
+    return true;
+}
+
+bool GLState::bindTextureBuffer(int unit, unsigned int id)
+{
+    assert(unit >= 0 && unit < MAX_TEXTURE_UNITS);
+    if (!count(id != textureBuffers[unit])) return false;
+    activeTexture(unit);
+    glBindTexture(GL_TEXTURE_BUFFER, id);
+    textureBuffers[unit] = id;
+    return true;
+}
+
+void GLState::activeTexture(int unit)
+{
+    if (unit == activeUnit) return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    activeUnit = unit;
+}
+
+bool GLState::bindBufferBase(unsigned int index, unsigned int buffer)
+{
+    assert(index < MAX_UNIFORM_BINDINGS);
+    BufferRange &current = uniforms[index];
+    if (!count(current.buffer != buffer || current.size != 0)) return false;
+    glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+    current = BufferRange{buffer, 0, 0};
+    return true;
+}
+
+bool GLState::bindBufferRange(unsigned int index, unsigned int buffer, ptrdiff_t offset, ptrdiff_t size)
+{
+    assert(index < MAX_UNIFORM_BINDINGS && size > 0);
+    BufferRange &current = uniforms[index];
+    if (!count(current.buffer != buffer || current.offset != offset || current.size != size))
+        return false;
+    glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+    current = BufferRange{buffer, offset, size};
+    return true;
+}
+
+bool GLState::bindFramebuffer(unsigned int target, unsigned int id)
+{
+    bool draw = target != GL_READ_FRAMEBUFFER, read = target != GL_DRAW_FRAMEBUFFER;
+    if (!count((draw && id != drawFramebuffer) || (read && id != readFramebuffer))) return false;
+    glBindFramebuffer(target, id);
+    if (draw) drawFramebuffer = id;
+    if (read) readFramebuffer = id;
+    return true;
+}
+
+void GLState::deletedProgram(unsigned int id)
+{
+    // a deleted program stays in use, but its name may be reused
+    if (program == id) program = ~0u;
+}
+
+void GLState::deletedVertexArray(unsigned int id)
+{
+    if (vertexArray == id) vertexArray = 0;
+}
+
+void GLState::deletedTexture(unsigned int id)
+{
+    for (auto &texture : textures)
+        if (texture == id) texture = 0;
+    for (auto &texture : textureBuffers)
+        if (texture == id) texture = 0;
+}
+
+void GLState::deletedBuffer(unsigned int id)
+{
+    for (auto &uniform : uniforms)
+        if (uniform.buffer == id) uniform = BufferRange{0, 0, 0};
+}
+
+void GLState::deletedFramebuffer(unsigned int id)
+{
+    if (drawFramebuffer == id) drawFramebuffer = 0;
+    if (readFramebuffer == id) readFramebuffer = 0;
+}
+
+void GLState::newFrame()
+{
+    lastFrame = frame;
+    frame = Counts{0, 0};
+}
+
+void GLState::report(const char *label) const
+{
+    printf("%s: %d binds issued, %d redundant binds skipped per frame\n",
+        label, lastFrame.issued, lastFrame.skipped);
+}
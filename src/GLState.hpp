@@ -0,0 +1,70 @@
+// tracks current GL bindings, so redundant bind calls can be skipped
+#pragma once
+
+#include <stddef.h>
+
+class GLState {
+public:
+    enum { MAX_TEXTURE_UNITS = 16, MAX_UNIFORM_BINDINGS = 16 };
+
+    // bind calls this frame and last frame
+    struct Counts {
+        int issued;                     // passed on to GL
+        int skipped;                    // already current
+    } frame, lastFrame;
+
+private:
+    unsigned int program;
+    unsigned int vertexArray;
+    int activeUnit;                     // 0 for GL_TEXTURE0
+    unsigned int textures[MAX_TEXTURE_UNITS];   // GL_TEXTURE_2D per unit
+    unsigned int textureBuffers[MAX_TEXTURE_UNITS]; // GL_TEXTURE_BUFFER per unit
+
+    // GL_UNIFORM_BUFFER indexed bindings, size 0 for whole buffer
+    struct BufferRange {
+        unsigned int buffer;
+        ptrdiff_t offset, size;
+    } uniforms[MAX_UNIFORM_BINDINGS];
+
+    unsigned int drawFramebuffer, readFramebuffer;
+
+public:
+    // starts with GL default state
+    GLState();
+
+    // state for the one GL context
+    static GLState &global();
+
+    // bind only if different than current
+    // return true if a GL call was made
+    bool useProgram(unsigned int id);
+    bool bindVertexArray(unsigned int id);
+    bool bindTexture(int unit, unsigned int id);        // GL_TEXTURE_2D
+    bool bindTextureBuffer(int unit, unsigned int id);  // GL_TEXTURE_BUFFER
+    bool bindBufferBase(unsigned int index, unsigned int buffer);   // GL_UNIFORM_BUFFER
+    bool bindBufferRange(unsigned int index, unsigned int buffer, ptrdiff_t offset, ptrdiff_t size);
+    bool bindFramebuffer(unsigned int target, unsigned int id);
+
+    // call after deleting GL objects, since GL unbinds them
+    void deletedProgram(unsigned int id);
+    void deletedVertexArray(unsigned int id);
+    void deletedTexture(unsigned int id);
+    void deletedBuffer(unsigned int id);
+    void deletedFramebuffer(unsigned int id);
+
+    // call at the start of each frame to reset counts
+    void newFrame();
+
+    // print last frame's counts
+    void report(const char *label) const;
+
+private:
+    // make a texture unit active for binding
+    void activeTexture(int unit);
+
+    // update counts, return issued
+    bool count(bool issue) {
+        if (issue) ++frame.issued; else ++frame.skipped;
+        return issue;
+    }
+};
@@ -5,16 +5,33 @@
 
 #include "GLapp.hpp"
 #include "Sphere.hpp"
+#include "SphereInstances.hpp"
 #include "Plane.hpp"
 #include "ObjLoad.hpp"
 #include "NavMesh.hpp"
+#include "MeshData.hpp"
+#include "ThreadPool.hpp"
+#include "SceneLoader.hpp"
+#include "Shader.hpp"
+#include "RenderQueue.hpp"
+#include "GLState.hpp"
+#include "GeometryPool.hpp"
+#include "UniformRing.hpp"
+#include "FrustumCuller.hpp"
+#include "OcclusionCuller.hpp"
+#include "OcclusionQueries.hpp"
+#include "PotentiallyVisibleSet.hpp"
+#include "GBuffer.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include <string>
+#include <chrono>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 #ifndef F_PI
@@ -88,10 +105,11 @@ extern "C" {
                 app->moveRate = -app->speed;
                 return;
 
-            case 'R':                   // reload shaders
-                for (auto object : app->objects)
-                    object->updateShaders();
+            case 'R': {                 // reload shaders, once per unique program
+                int programs = ShaderProgram::reloadAll();
+                printf("reloading %d shader programs\n", programs);
                 return;
+            }
 
             case 'I':                   // cycle through ambient intensity
                 app->sceneShaderData.LightDir.a += 0.2f;
@@ -99,24 +117,68 @@ extern "C" {
                     app->sceneShaderData.LightDir.a = 0.f;
                 return;
 
+            case 'V':                   // toggle shader variants vs. generic shader
+                app->reportGPUTime(Object::useVariants ? "shader variants" : "generic shader");
+                Object::useVariants = !Object::useVariants;
+                return;
+
+            case 'M':                   // toggle indirect draws of pooled meshes
+                app->queue->report(Object::useIndirect ? "indirect" : "direct");
+                app->reportGPUTime(Object::useIndirect ? "indirect" : "direct");
+                Object::useIndirect = !Object::useIndirect;
+                return;
+
+            case 'Q':                   // toggle sorted drawing vs. load order
+                app->queue->report(app->sortDraws ? "sorted" : "load order");
+                GLState::global().report(app->sortDraws ? "sorted" : "load order");
+                app->reportGPUTime(app->sortDraws ? "sorted" : "load order");
+                app->sortDraws = !app->sortDraws;
+                return;
+
+            case 'F':                   // toggle frustum culling
+                if (app->frustumCull) app->frustumCuller->report("frustum culling");
+                app->frustumCull = !app->frustumCull;
+                return;
+
+            case 'B':                   // toggle cluster backface culling
+                if (app->coneCull) printf("backface culling: %d clusters culled\n", app->coneCulled);
+                app->coneCull = !app->coneCull;
+                return;
+
+            case 'O':                   // toggle occlusion culling
+                if (app->occlusionCull) app->occlusionCuller->report("occlusion culling");
+                app->occlusionCull = !app->occlusionCull;
+                return;
+
+            case 'G':                   // toggle GPU occlusion queries
+                if (app->queryCull) app->occlusionQueries->report("occlusion queries");
+                app->queryCull = !app->queryCull;
+                return;
+
+            case 'P':                   // toggle potentially visible set
+                if (app->pvsCull) printf("PVS: %s, %d clusters culled\n",
+                    app->pvsMatches ? "matches scene" : "none for this scene", app->pvsCulled);
+                app->pvsCull = !app->pvsCull;
+                return;
+
             case 'L':                   // toggle lines or solid
                 app->wireframe = !app->wireframe;
                 glPolygonMode(GL_FRONT_AND_BACK, app->wireframe ? GL_LINE : GL_FILL);
                 return;
 
-            case '0':                   // show gBuffer 0
+            case '0':                   // show G-buffer albedo
                 app->renderMode = '0';
                 return;
 
-            case '1':                   // show gBuffer 1
+            case '1':                   // show G-buffer normals
                 app->renderMode = '1';
                 return;
 
-            case '2':                   // show gBuffer 2
+            case '2':                   // show positions rebuilt from G-buffer depth
                 app->renderMode = '2';
                 return;
 
-            case '-':                   // show final render result
+            case '-':                   // show final lit result
                 app->renderMode = '-';
                 return;
 
@@ -158,8 +220,24 @@ GLapp::GLapp()
     mouseX = mouseY = 0.f;                      // mouse view controls
     wireframe = false;                          // solid drawing
     renderMode = '-';
+    timerFrame = 0; gpuTime = 0; gpuFrames = 0; // GPU timing
 
     navmesh = new NavMesh;
+    queue = new RenderQueue;
+    sortDraws = true;                           // state-sorted drawing
+    frustumCuller = new FrustumCuller;
+    frustumCull = true;                         // cull clusters out of view
+    coneCull = false;                           // no backface culling to match
+    coneCulled = 0;
+    occlusionCuller = new OcclusionCuller;
+    occlusionCull = true;                       // cull clusters hidden by others
+    occluderObjects = 0;
+    queryCull = false;                          // GPU queries, off by default
+    pvs = new PotentiallyVisibleSet;
+    pvsCull = true;                             // whenever there is a PVS
+    pvsMatches = false;
+    pvsCheckedClusters = 0;
+    pvsCulled = 0;
 
     // set error callback before init
     glfwSetErrorCallback(error);
@@ -208,55 +286,26 @@ GLapp::GLapp()
     // tell OpenGL to enable z-buffer for overlapping surfaces
     glEnable(GL_DEPTH_TEST);
 
-    // initialize buffer for scene shader data
-    glGenBuffers(1, &sceneUniformsID);
-    glBindBuffer(GL_UNIFORM_BUFFER, sceneUniformsID);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(SceneShaderData), 0, GL_STREAM_DRAW);
-
-    // initialize scene data
-    sceneShaderData.LightDir = vec4(-1,-2,2,0);
-
-    // frame buffer creation
-
-    /*GLuint gBuffer;
-    glGenFramebuffers(1, &gBuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);*/
-
-    glGenTextures(1, &gAlbedo);
-    glBindTexture(GL_TEXTURE_2D, gAlbedo);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGB, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gAlbedo, 0);
+    // queries to time drawing on the GPU
+    glGenQueries(2, timerQueries);
 
-    glGenTextures(1, &gNorm);
-    glBindTexture(GL_TEXTURE_2D, gNorm);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGB, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNorm, 0);
+    // initialize buffer for per-frame scene and object shader data
+    uniforms = new UniformRing;
+    sceneUniformsOffset = 0;
+    GeometryPool::global().setObjectData(uniforms->id());
 
+    // bounding box drawing for GPU occlusion queries
+    occlusionQueries = new OcclusionQueries;
 
-    glGenTextures(1, &gPos);
-    glBindTexture(GL_TEXTURE_2D, gPos);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGB, GL_FLOAT, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gPos, 0);
-
-
-    GLuint depthrenderbuffer;
-    glGenRenderbuffers(1, &depthrenderbuffer);
-    glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
+    // initialize scene data
+    sceneShaderData.LightDir = vec4(-1,-2,2,0);
 
-    GLenum DrawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-    glDrawBuffers(3, DrawBuffers);
+    // G-buffer, sized on the first frame
+    gbuffer = new GBuffer;
 
-    // The fullscreen quad's FBO
+    // full-screen quad for the lighting pass, two triangles in clip space
     glGenVertexArrays(1, &quad_VertexArrayID);
-    glBindVertexArray(quad_VertexArrayID);
+    GLState::global().bindVertexArray(quad_VertexArrayID);
 
     static const GLfloat g_quad_vertex_buffer_data[] = {
         -1.0f, -1.0f, 0.0f,
@@ -270,24 +319,36 @@ GLapp::GLapp()
     glGenBuffers(1, &quad_vertexbuffer);
     glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(g_quad_vertex_buffer_data), g_quad_vertex_buffer_data, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
 
-    // Create and compile our GLSL program for screen quad
-    /*GLuint quad_programID = glCreateProgram();
-    GLuint vs_ID = loadShader(GL_VERTEX_SHADER, "Passthrough.vertexshader");
-    GLuint fs_ID = loadShader(GL_VERTEX_SHADER, "Passthrough.fragmentshader");
-    glAttachShader(quad_programID, vs_ID);
-    glAttachShader(quad_programID, fs_ID);
-    GLuint texID = glGetUniformLocation(quad_programID, "renderedTexture");
-    GLuint timeID = glGetUniformLocation(quad_programID, "time");*/
+    lightingProgram = ShaderProgram::get({"Passthrough.vertexshader", "Passthrough.fragmentshader"},
+        "", setupLightingProgram);
+    lightingProgramID = 0;
+    modeLocation = -1;
 }
 
 ///////
 // Clean up any context data
 GLapp::~GLapp() 
 {
-    for (auto obj: objects)
+    for (auto obj: objects) {
+        occlusionQueries->forget(obj);
         delete obj;
+    }
     delete navmesh;
+    delete queue;
+    delete frustumCuller;
+    delete occlusionCuller;
+    delete occlusionQueries;
+    delete pvs;
+    delete gbuffer;
+    glDeleteBuffers(1, &quad_vertexbuffer);
+    glDeleteVertexArrays(1, &quad_VertexArrayID);
+    GLState::global().deletedBuffer(quad_vertexbuffer);
+    GLState::global().deletedVertexArray(quad_VertexArrayID);
+    delete uniforms;
+    glDeleteQueries(2, timerQueries);
 
     glfwDestroyWindow(win);
     glfwTerminate();
@@ -317,50 +378,6 @@ void GLapp::sceneUpdate(float dTime)
         * rotate(mat4(1), pan, vec3(0,0,1))
         * translate(mat4(1), -position);
     sceneShaderData.WorldFromProj = inverse(sceneShaderData.ProjFromWorld);
-
-    // Check for Selected Render Mode
-    switch(renderMode) {
-        case '0':
-            // Render Albedo G-Buffer
-            glBindFramebuffer(GL_FRAMEBUFFER, gAlbedo);
-            glViewport(0,0,width,height);
-
-            // Disable Depth Test for Perform Deferred Pass
-            glDisable(GL_DEPTH_TEST);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            glViewport(0, 0, width, height);
-            glEnable(GL_DEPTH_TEST);
-            break;
-
-        case '1':
-            // Render Norm G-Buffer
-            glBindFramebuffer(GL_FRAMEBUFFER, gNorm);
-            glViewport(0, 0, width, height);
-
-            // Disable Depth Test for Perform Deferred Pass
-            glDisable(GL_DEPTH_TEST);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            glViewport(0, 0, width, height);
-            glEnable(GL_DEPTH_TEST);
-            break;
-
-        case '2':
-            // Render Pos G-Buffer
-            glBindFramebuffer(GL_FRAMEBUFFER, gPos);
-            glViewport(0, 0, width, height);
-
-            // Disable Depth Test for Perform Deferred Pass
-            glDisable(GL_DEPTH_TEST);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            glViewport(0, 0, width, height);
-            glEnable(GL_DEPTH_TEST);
-            break;
-
-        default:
-            glBindBuffer(GL_UNIFORM_BUFFER, sceneUniformsID);
-            glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SceneShaderData), &sceneShaderData);
-            break;
-    }
 }
 
 // render a frame
@@ -368,59 +385,348 @@ void GLapp::render()
 {
     // consistent time for drawing this frame
     double currTime = glfwGetTime();
+    GLState::global().newFrame();
     double dTime = currTime - prevTime;
 
-    // Check for Selected Render Mode
-    switch (renderMode) {
-        case '0':
-            // clear old screen contents to zero
-            glClearColor(0.0, 0.0, 0.0, 0.f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            break;
-
-        case '1':
-            // clear old screen contents to zero
-            glClearColor(0.0, 0.0, 0.0, 0.f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            break;
-
-        case '2':
-            // clear old screen contents to zero
-            glClearColor(0.0, 0.0, 0.0, 0.f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            break;
-
-        default:
-            // clear old screen contents to a sky blue
-            glClearColor(0.5, 0.7, 0.9, 1.f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            break;
-    }
+    // geometry pass into the G-buffer, cleared to zero
+    gbuffer->resize(width, height);
+    GLState::global().bindFramebuffer(GL_FRAMEBUFFER, gbuffer->fbo);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // swap in any shaders that finished compiling
+    ShaderProgram::pollAll();
 
-    // draw all objects
+    // update scene and objects, then write all of their uniforms at once
     sceneUpdate(dTime);
     for (auto object : objects)
-        object->draw(this, currTime);
+        object->update(this, currTime);
+    size_t objectSize = uniforms->aligned(sizeof(Object::ObjectShaderData));
+    uniforms->map(uniforms->aligned(sizeof(SceneShaderData)) + objects.size() * objectSize);
+    sceneUniformsOffset = uniforms->push(&sceneShaderData, sizeof(SceneShaderData));
+    for (auto object : objects)
+        object->uniformsOffset = uniforms->push(&object->objectShaderData, sizeof(Object::ObjectShaderData));
+    uniforms->unmap();
+
+    // draw all objects, then light them, timing on the GPU
+    int query = timerFrame & 1;
+    glBeginQuery(GL_TIME_ELAPSED, timerQueries[query]);
+    queue->clear();
+    cull();
+    for (auto object : objects)
+        if (!object->drawCounts.empty()) queue->add(object, this);
+    occlusionQueries->begin(this, queryCull);
+    queue->submit(this, currTime, sortDraws);
+    if (queryCull) occlusionQueries->issue(this, currTime);
+    light();
+    glEndQuery(GL_TIME_ELAPSED);
+    uniforms->fence();
+
+    // last frame's query is usually done by now, skip it if not
+    if (timerFrame > 0) {
+        GLint available = 0;
+        glGetQueryObjectiv(timerQueries[query ^ 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(timerQueries[query ^ 1], GL_QUERY_RESULT, &elapsed);
+            gpuTime += elapsed * 1e-6;
+            ++gpuFrames;
+        }
+    }
+    ++timerFrame;
 
     // show what we drew
     glfwSwapBuffers(win);
     prevTime = currTime;
 }
 
+// find objects that might be visible this frame
+void GLapp::cull()
+{
+    size_t numClusters = 0;
+    for (auto object : objects)
+        numClusters += object->clusters.size();
+    visible.assign(numClusters, 1);
+
+    if (frustumCull) {
+        frustumCuller->setFrustum(sceneShaderData.ProjFromWorld);
+        frustumCuller->clear();
+        for (auto object : objects)
+            for (auto &cluster : object->clusters)
+                frustumCuller->add(cluster.boundsMin, cluster.boundsMax, cluster.sphere,
+                    object->objectShaderData.WorldFromModel);
+        frustumCuller->test(visible);
+    }
+
+    // baked visibility from the player's cell, once all of its clusters are loaded
+    pvsCulled = 0;
+    if (numClusters != pvsCheckedClusters) {
+        pvsCheckedClusters = numClusters;
+        pvsMatches = false;
+        if (!pvs->empty() && numClusters == size_t(pvs->numClusters)) {
+            uint64_t hash = PotentiallyVisibleSet::hashClusters({});
+            for (auto object : objects)
+                hash = PotentiallyVisibleSet::hashClusters(object->clusters, hash);
+            pvsMatches = hash == pvs->clusterHash;
+        }
+    }
+    const uint32_t *pvsBits = pvsCull && pvsMatches ? pvs->cellBits(position) : nullptr;
+    if (pvsBits) {
+        for (size_t c=0; c < numClusters; ++c)
+            if (visible[c] && !(pvsBits[c >> 5] & 1u << (c & 31))) {
+                visible[c] = 0;
+                ++pvsCulled;
+            }
+    }
+
+    // backface cone test in model space
+    coneCulled = 0;
+    if (coneCull) {
+        size_t first = 0;
+        for (auto object : objects) {
+            char *objectVisible = visible.data() + first;
+            vec3 eye = vec3(object->objectShaderData.ModelFromWorld * vec4(position, 1));
+            for (size_t c=0; c < object->clusters.size(); ++c)
+                if (objectVisible[c] && object->clusters[c].backfacing(eye)) {
+                    objectVisible[c] = 0;
+                    ++coneCulled;
+                }
+            first += object->clusters.size();
+        }
+    }
+
+    // occlusion test of what's left, with occluders from objects as they load
+    for (; occluderObjects < objects.size(); ++occluderObjects) {
+        Object *object = objects[occluderObjects];
+        if (object->occluder)
+            occlusionCuller->addOccluders(object->occluders,
+                object->objectShaderData.WorldFromModel);
+    }
+    if (occlusionCull) {
+        occlusionCuller->render(sceneShaderData.ProjFromWorld, ThreadPool::global());
+        occlusionCuller->clearBoxes();
+        for (auto object : objects)
+            for (auto &cluster : object->clusters)
+                occlusionCuller->addBox(cluster.boundsMin, cluster.boundsMax,
+                    object->objectShaderData.WorldFromModel);
+        occlusionCuller->test(visible, ThreadPool::global());
+    }
+
+    // merge what's left into draw ranges
+    size_t first = 0;
+    for (auto object : objects) {
+        object->setVisibleClusters(visible.data() + first);
+        first += object->clusters.size();
+    }
+}
+
+// lighting pass, reading every G-buffer attribute once per pixel
+void GLapp::light()
+{
+    GLState &state = GLState::global();
+    state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!lightingProgram->id) {
+        glClearColor(0.5, 0.7, 0.9, 1.f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        return;
+    }
+
+    state.useProgram(lightingProgram->id);
+    if (lightingProgramID != lightingProgram->id) {
+        lightingProgramID = lightingProgram->id;
+        modeLocation = glGetUniformLocation(lightingProgramID, "Mode");
+    }
+    glUniform1i(modeLocation, renderMode >= '0' && renderMode <= '2' ? renderMode - '0' : -1);
+    gbuffer->bindTextures(0);
+    state.bindBufferRange(0, uniforms->id(), sceneUniformsOffset, sizeof(SceneShaderData));
+    state.bindVertexArray(quad_VertexArrayID);
+
+    // every pixel exactly once, whatever the drawing mode
+    glDisable(GL_DEPTH_TEST);
+    if (wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    if (wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    glEnable(GL_DEPTH_TEST);
+}
+
+// set up a newly linked lighting program
+void GLapp::setupLightingProgram(unsigned int programID)
+{
+    GLState::global().useProgram(programID);
+    glUniformBlockBinding(programID, glGetUniformBlockIndex(programID, "SceneData"), 0);
+
+    // texture units match GBuffer::bindTextures(0)
+    glUniform1i(glGetUniformLocation(programID, "AlbedoTexture"),   GBuffer::ALBEDO);
+    glUniform1i(glGetUniformLocation(programID, "NormalTexture"),   GBuffer::NORMAL);
+    glUniform1i(glGetUniformLocation(programID, "SpecularTexture"), GBuffer::SPECULAR);
+    glUniform1i(glGetUniformLocation(programID, "AmbientTexture"),  GBuffer::AMBIENT);
+    glUniform1i(glGetUniformLocation(programID, "DepthTexture"),    GBuffer::NUM_COLORS);
+}
+
+// print and reset average GPU time for drawing objects
+void GLapp::reportGPUTime(const char *label)
+{
+    if (gpuFrames)
+        printf("%s: %g ms GPU per frame over %d frames, %d shader programs\n",
+            label, gpuTime / gpuFrames, gpuFrames, ShaderProgram::count());
+    gpuTime = 0;
+    gpuFrames = 0;
+}
+
+// time drawing moving spheres as separate objects or as instances of one object,
+// for each count in a sweep, printing CPU and GPU time per frame
+static void instanceBenchmark(GLapp &app)
+{
+    glfwSwapInterval(0);                // time drawing, not waiting for the display
+    const int frames = 200;
+
+    // square grid facing the viewer, filling the view
+    vec3 forward(sinf(app.pan), cosf(app.pan), 0);
+    vec3 gridCenter = app.position + 2000.f * forward - vec3(0, 0, 100);
+    for (int count = 1; count <= 100000; count *= 10) {
+        int side = int(ceilf(sqrtf(float(count))));
+        float spacing = 1600.f / side;
+        std::vector<vec3> centers;
+        std::vector<float> phases;
+        for (int i=0; i < count; ++i) {
+            vec2 grid = vec2(i % side, i / side) - 0.5f * float(side - 1);
+            centers.push_back(gridCenter + spacing * vec3(0, grid.x, grid.y));
+            phases.push_back(6.2831853f * fmodf(i * 0.618034f, 1.f));
+        }
+
+        for (int instanced = 1; instanced >= 0; --instanced) {
+            if (!instanced && count > 10000) continue;  // too slow to be worth waiting for
+            vec3 size(0.3f * spacing);
+            if (instanced)
+                app.objects.push_back(new SphereInstances(16, 8, size, "pebbles.ppm", centers, phases));
+            else for (int i=0; i < count; ++i) {
+                Sphere *sphere = new Sphere(16, 8, size, "pebbles.ppm");
+                sphere->center = centers[i];
+                sphere->phase = phases[i];
+                app.objects.push_back(sphere);
+            }
+
+            // programs compile in the background, then a few frames to settle
+            while (!app.objects[0]->currentProgram()->id && !glfwWindowShouldClose(app.win)) {
+                app.render();
+                glfwPollEvents();
+            }
+            for (int i=0; i < 10; ++i) app.render();
+
+            app.gpuTime = 0;
+            app.gpuFrames = 0;
+            auto startTime = std::chrono::high_resolution_clock::now();
+            for (int i=0; i < frames; ++i) {
+                app.render();
+                glfwPollEvents();
+            }
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+            printf("%6d spheres %-9s: %8.3f ms CPU, %8.3f ms GPU per frame, %d draws\n",
+                count, instanced ? "instanced" : "separate", 1000 * elapsed.count() / frames,
+                app.gpuFrames ? app.gpuTime / app.gpuFrames : 0.0, app.queue->stats.drawCalls);
+
+            for (auto object : app.objects) {
+                app.occlusionQueries->forget(object);
+                delete object;
+            }
+            app.objects.clear();
+            app.occluderObjects = 0;
+            if (glfwWindowShouldClose(app.win)) return;
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
+    // command line options
+    unsigned threads = 0;               // OBJ parsing threads, 0 = all cores
+    bool useCache = true;               // use/update binary scene cache
+    bool headless = false;              // load without window or GL
+    bool bakePVS = false;               // compute visibility and exit
+    float pvsCellSize = 1000;           // PVS cell width in scene units
+    bool instanceBench = false;         // time instanced drawing and exit
+    for (int i=1; i < argc; ++i) {
+        if (strcmp(argv[i], "-threads") == 0 && i+1 < argc)
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-nocache") == 0)
+            useCache = false;
+        else if (strcmp(argv[i], "-headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "-bakepvs") == 0)
+            bakePVS = true;
+        else if (strcmp(argv[i], "-pvscell") == 0 && i+1 < argc)
+            pvsCellSize = float(atof(argv[++i]));
+        else if (strcmp(argv[i], "-instancebench") == 0)
+            instanceBench = true;
+    }
+
+    // offline visibility bake, saved next to the scene
+    if (bakePVS) {
+        NavMesh navmesh;
+        std::vector<MeshData> meshes;
+        ObjParse("castle/castle.obj", meshes, &navmesh, threads, useCache);
+        navmesh.buildBVH();
+
+        PotentiallyVisibleSet pvs;
+        pvs.bake(meshes, navmesh, pvsCellSize, ThreadPool::global());
+        if (!pvs.save("castle/castle.obj.pvs")) {
+            fprintf(stderr, "could not write castle/castle.obj.pvs\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    // just time the CPU side of loading, no GPU needed
+    if (headless) {
+        NavMesh navmesh;
+        std::vector<MeshData> meshes;
+        ObjParse("castle/castle.obj", meshes, &navmesh, threads, useCache);
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        navmesh.buildBVH();
+        std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        printf("navmesh BVH in %g seconds\n", elapsed.count());
+
+        startTime = std::chrono::high_resolution_clock::now();
+        decodeTextures(meshes, ThreadPool::global());
+        elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        printf("texture decode in %g seconds\n", elapsed.count());
+        return 0;
+    }
+
     // initialize windows and OpenGL
     GLapp app;
 
-    ObjLoad(app, app.navmesh, "castle/castle.obj");
+    // spheres alone, without loading the scene
+    if (instanceBench) {
+        reshape(app.win, app.width, app.height);
+        instanceBenchmark(app);
+        return 0;
+    }
+
+    // baked visibility, if there is one for this scene
+    if (app.pvs->load("castle/castle.obj.pvs"))
+        printf("PVS: %d cells, %zu bytes\n", app.pvs->cellsX * app.pvs->cellsY, app.pvs->bytes());
+
+    // load in the background, drawing whatever is resident so far
+    auto startTime = std::chrono::high_resolution_clock::now();
+    SceneLoader loader("castle/castle.obj", threads, useCache);
 
     // set up initial viewport
     reshape(app.win, app.width, app.height);
 
-    // each frame: render then check for events
+    // each frame: upload some of the scene, render, then check for events
+    bool firstFrame = true;
     while (!glfwWindowShouldClose(app.win)) {
+        loader.update(app, 0.005);
         app.render();
         glfwPollEvents();
+
+        if (firstFrame) {
+            std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+            printf("first frame after %g ms\n", 1000 * elapsed.count());
+            firstFrame = false;
+        }
     }
 
     return 0;
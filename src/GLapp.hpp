@@ -18,7 +18,10 @@ public:
         glm::mat4 ProjFromWorld, WorldFromProj;  // viewing matrix & inverse
         glm::vec4 LightDir;         // xyz = light direction; w = ambient
     } sceneShaderData;
-    unsigned int sceneUniformsID;
+
+    // this frame's scene and object uniforms, all in one buffer
+    class UniformRing *uniforms;
+    size_t sceneUniformsOffset;     // where sceneShaderData is in uniforms
 
     // view info
     bool active;                // clicked into window
@@ -27,7 +30,7 @@ public:
     glm::vec3 position;         // player position
     float pan, tilt;            // horizontal and vertical Euler angles
     float speed, moveRate, strafeRate; // keyboard motion rate in units/sec
-    char renderMode;
+    char renderMode;            // '0'-'2' to show a G-buffer attribute, '-' for lit
 
     // mouse state
     double mouseX, mouseY;      // location of mouse at last event
@@ -38,12 +41,41 @@ public:
     // time (in seconds) of last frame
     double prevTime;
 
-    // frame buffers
-    GLuint gAlbedo, gNorm, gPos;
-    GLuint quad_VertexArrayID, quad_vertexbuffer;;
+    // GPU time drawing objects, from timer queries read one frame late
+    unsigned int timerQueries[2];
+    int timerFrame;             // frames timed, alternating queries
+    double gpuTime;             // total milliseconds since last report
+    int gpuFrames;              // frames in gpuTime
+
+    // deferred shading: objects draw into the G-buffer,
+    // then one full-screen quad lights every pixel
+    class GBuffer *gbuffer;
+    GLuint quad_VertexArrayID, quad_vertexbuffer;
+    class ShaderProgram *lightingProgram;
+    unsigned int lightingProgramID;     // program modeLocation is for
+    int modeLocation;
 
     // objects to draw
     std::vector<class Object*> objects;
+    class RenderQueue *queue;   // rebuilt each frame from objects
+    bool sortDraws;             // sort queue to reduce state changes
+
+    // culling
+    class FrustumCuller *frustumCuller;
+    bool frustumCull;           // skip clusters outside the view
+    bool coneCull;              // skip clusters facing away from the view
+    int coneCulled;             // clusters skipped by coneCull this frame
+    class OcclusionCuller *occlusionCuller;
+    bool occlusionCull;         // skip clusters hidden behind occluders
+    size_t occluderObjects;     // objects already added as occluders
+    class OcclusionQueries *occlusionQueries;
+    class PotentiallyVisibleSet *pvs;   // baked visibility, empty if none
+    bool pvsCull;               // skip clusters not in the player cell's PVS
+    bool pvsMatches;            // pvs was baked for the clusters loaded so far
+    size_t pvsCheckedClusters;  // cluster count when pvsMatches was set
+    int pvsCulled;              // clusters skipped by the PVS this frame
+    bool queryCull;             // skip objects whose box was hidden last frame on the GPU
+    std::vector<char> visible;  // per cluster of each object, from culling this frame
 
     // ray tracing data
     class NavMesh *navmesh;
@@ -58,4 +90,16 @@ public:
 
     // main rendering loop
     void render();
+
+    // fill visible array for this frame's object clusters, and set object draw ranges
+    void cull();
+
+    // light the G-buffer into the window, or show one of its attributes
+    void light();
+
+    // uniform block and sampler bindings for the lighting program
+    static void setupLightingProgram(unsigned int programID);
+
+    // print and reset average GPU time for drawing objects
+    void reportGPUTime(const char *label);
 };
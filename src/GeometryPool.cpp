@@ -0,0 +1,176 @@
+// static meshes packed into shared vertex and index buffers, drawn indirectly
+
+#include "GeometryPool.hpp"
+#include "Object.hpp"
+#include "GLState.hpp"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <stdio.h>
+#include <assert.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+GeometryPool::GeometryPool()
+    : multiDraw(false), varrayID(0), bufferIDs{0}, vertexCount(0), vertexCapacity(0),
+      indexCount(0), indexCapacity(0), commandBuffer(0), objectTexture(0), objectBytes(0)
+{
+}
+
+GeometryPool &GeometryPool::global()
+{
+    // never destroyed, so no GL calls happen after the context is gone
+    static GeometryPool *pool = new GeometryPool;
+    return *pool;
+}
+
+void GeometryPool::add(const std::vector<vec3> &vert, const std::vector<vec3> &norm,
+    const std::vector<vec2> &uv, const std::vector<unsigned int> &indices,
+    int &baseVertex, unsigned int &firstIndex)
+{
+    assert(norm.size() == vert.size() && uv.size() == vert.size());
+    if (!varrayID) {
+        glGenVertexArrays(1, &varrayID);
+        glGenBuffers(NUM_BUFFERS, bufferIDs);
+        glGenBuffers(1, &commandBuffer);
+        multiDraw = (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect)
+            && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+    }
+
+    // double as needed, so loading many meshes copies each vertex only a few times
+    bool grew = false;
+    if (vertexCount + vert.size() > vertexCapacity) {
+        size_t capacity = std::max(vertexCount + vert.size(), 2 * vertexCapacity);
+        grow(POSITION_BUFFER, vertexCount * sizeof(vec3), capacity * sizeof(vec3));
+        grow(NORMAL_BUFFER, vertexCount * sizeof(vec3), capacity * sizeof(vec3));
+        grow(UV_BUFFER, vertexCount * sizeof(vec2), capacity * sizeof(vec2));
+        vertexCapacity = capacity;
+        grew = true;
+    }
+    if (indexCount + indices.size() > indexCapacity) {
+        size_t capacity = std::max(indexCount + indices.size(), 2 * indexCapacity);
+        grow(INDEX_BUFFER, indexCount * sizeof(unsigned int), capacity * sizeof(unsigned int));
+        indexCapacity = capacity;
+        grew = true;
+    }
+    if (grew) initVertexArray();
+
+    // copy targets, so no vertex array's element buffer changes
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[POSITION_BUFFER]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * sizeof(vec3), vert.size() * sizeof(vec3), vert.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[NORMAL_BUFFER]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * sizeof(vec3), norm.size() * sizeof(vec3), norm.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[UV_BUFFER]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * sizeof(vec2), uv.size() * sizeof(vec2), uv.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int),
+        indices.size() * sizeof(unsigned int), indices.data());
+
+    baseVertex = int(vertexCount);
+    firstIndex = unsigned(indexCount);
+    vertexCount += vert.size();
+    indexCount += indices.size();
+}
+
+void GeometryPool::grow(int buffer, size_t oldBytes, size_t newBytes)
+{
+    unsigned int newID;
+    glGenBuffers(1, &newID);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newID);
+    glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+    if (oldBytes) {
+        glBindBuffer(GL_COPY_READ_BUFFER, bufferIDs[buffer]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+    }
+    glDeleteBuffers(1, &bufferIDs[buffer]);
+    GLState::global().deletedBuffer(bufferIDs[buffer]);
+    bufferIDs[buffer] = newID;
+}
+
+void GeometryPool::initVertexArray()
+{
+    GLState::global().bindVertexArray(varrayID);
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
+    glVertexAttribPointer(Object::POSITION_ATTRIB, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(Object::POSITION_ATTRIB);
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
+    glVertexAttribPointer(Object::NORMAL_ATTRIB, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(Object::NORMAL_ATTRIB);
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[UV_BUFFER]);
+    glVertexAttribPointer(Object::UV_ATTRIB, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(Object::UV_ATTRIB);
+
+    // one object data texel per draw, stepped by base instance in multi-draw
+    // the array is only enabled around multi-draw calls, otherwise the
+    // attribute's current value set by glVertexAttribI1ui is used
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[TEXEL_BUFFER]);
+    glVertexAttribIPointer(Object::OBJECT_TEXEL_ATTRIB, 1, GL_UNSIGNED_INT, 0, 0);
+    glVertexAttribDivisor(Object::OBJECT_TEXEL_ATTRIB, 1);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
+}
+
+void GeometryPool::setObjectData(unsigned int buffer)
+{
+    // binding creates a buffer that only has a name so far
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    if (!objectTexture) glGenTextures(1, &objectTexture);
+    GLState::global().bindTextureBuffer(Object::OBJECT_DATA_UNIT, objectTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    objectBytes = size_t(maxTexels) * sizeof(vec4);
+}
+
+bool GeometryPool::hasObjectData(size_t offset) const
+{
+    return offset % sizeof(vec4) == 0
+        && offset + sizeof(Object::ObjectShaderData) <= objectBytes;
+}
+
+void GeometryPool::setCommands(const std::vector<DrawCommand> &commands,
+    const std::vector<size_t> &objectOffsets)
+{
+    assert(commands.size() == objectOffsets.size());
+    texels.resize(objectOffsets.size());
+    for (size_t i=0; i < texels.size(); ++i)
+        texels[i] = uint32_t(objectOffsets[i] / sizeof(vec4));
+    if (commands.empty() || !varrayID) return;
+
+    // orphan last frame's data rather than wait for the GPU to finish with it
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand),
+        commands.data(), GL_STREAM_DRAW);
+    if (multiDraw) {
+        glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[TEXEL_BUFFER]);
+        glBufferData(GL_ARRAY_BUFFER, texels.size() * sizeof(texels[0]),
+            texels.data(), GL_STREAM_DRAW);
+    }
+}
+
+int GeometryPool::draw(size_t first, size_t count)
+{
+    assert(first + count <= texels.size());
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    const char *offset = (const char*)(first * sizeof(DrawCommand));
+
+    // base instance picks each draw's texel from the texel array
+    if (multiDraw) {
+        glEnableVertexAttribArray(Object::OBJECT_TEXEL_ATTRIB);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset, GLsizei(count), 0);
+        glDisableVertexAttribArray(Object::OBJECT_TEXEL_ATTRIB);
+        return 1;
+    }
+
+    // no multi-draw or no base instance, so set the texel between draws
+    for (size_t i=0; i < count; ++i) {
+        glVertexAttribI1ui(Object::OBJECT_TEXEL_ATTRIB, texels[first + i]);
+        glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset + i * sizeof(DrawCommand));
+    }
+    return int(count);
+}
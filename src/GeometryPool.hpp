@@ -0,0 +1,75 @@
+// static meshes packed into shared vertex and index buffers, drawn indirectly
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+class GeometryPool {
+public:
+    // layout of GL's DrawElementsIndirectCommand
+    struct DrawCommand {
+        uint32_t count;             // indices in this draw
+        uint32_t instanceCount;     // always 1
+        uint32_t firstIndex;        // into the shared index buffer
+        int32_t baseVertex;         // added to every index
+        uint32_t baseInstance;      // draw number with multi-draw, otherwise 0
+    };
+
+    // glMultiDrawElementsIndirect from GL 4.3 or ARB_multi_draw_indirect, with
+    // base instance from GL 4.2 or ARB_base_instance to pick each draw's texel
+    // otherwise one glDrawElementsIndirect per command
+    bool multiDraw;
+
+private:
+    // one vertex array over all pooled meshes
+    enum {POSITION_BUFFER, NORMAL_BUFFER, UV_BUFFER, INDEX_BUFFER, TEXEL_BUFFER, NUM_BUFFERS};
+    unsigned int varrayID, bufferIDs[NUM_BUFFERS];
+    size_t vertexCount, vertexCapacity;
+    size_t indexCount, indexCapacity;
+
+    // this frame's draws, and the object data texel for each
+    unsigned int commandBuffer;
+    std::vector<uint32_t> texels;
+
+    // per-object shader data, read through a texture buffer
+    unsigned int objectTexture;
+    size_t objectBytes;             // bytes the texture can reach, 0 if not set up
+
+public:
+    GeometryPool();
+
+    // pool used by all objects
+    static GeometryPool &global();
+
+    // append a mesh, returning the offsets to draw it with
+    void add(const std::vector<glm::vec3> &vert, const std::vector<glm::vec3> &norm,
+        const std::vector<glm::vec2> &uv, const std::vector<unsigned int> &indices,
+        int &baseVertex, unsigned int &firstIndex);
+
+    // shared vertex array, 0 before the first mesh is added
+    unsigned int vertexArray() const { return varrayID; }
+
+    // read per-object data from a buffer through a texture buffer,
+    // bound to texture unit OBJECT_DATA_UNIT in Object
+    void setObjectData(unsigned int buffer);
+
+    // true if the texture buffer reaches ObjectShaderData at this offset
+    bool hasObjectData(size_t offset) const;
+
+    // replace this frame's commands, with the object data offset for each
+    void setCommands(const std::vector<DrawCommand> &commands,
+        const std::vector<size_t> &objectOffsets);
+
+    // issue commands [first, first+count) with program, textures, and vertex array bound
+    // return the number of GL draw calls
+    int draw(size_t first, size_t count);
+
+private:
+    // grow one buffer, keeping its contents
+    void grow(int buffer, size_t oldBytes, size_t newBytes);
+
+    // point vertex array attributes at the current buffers
+    void initVertexArray();
+};
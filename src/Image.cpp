@@ -0,0 +1,166 @@
+// decoded image data, independent of OpenGL
+
+#include "Image.hpp"
+#include "MappedFile.hpp"
+#include "config.h"
+
+#include <filesystem>
+#include <charconv>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define IMAGE_SSSE3 1
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+#ifdef _WIN32
+// don't complain if we use standard IO functions instead of windows-only
+#pragma warning( disable: 4996 )
+#endif
+
+// skip whitespace and # comments in PPM header
+static const char *skipHeaderSpace(const char *p, const char *end)
+{
+    while (p < end) {
+        if (*p == '#')
+            while (p < end && *p != '\n') ++p;
+        else if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            ++p;
+        else
+            break;
+    }
+    return p;
+}
+
+// read one number from PPM header, returning false if there isn't one
+static bool headerNumber(const char *&p, const char *end, int &value)
+{
+    p = skipHeaderSpace(p, end);
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc()) return false;
+    p = result.ptr;
+    return true;
+}
+
+// copy one channel of count RGB pixels into a single byte per pixel
+static void extractChannelScalar(const uint8_t *src, uint8_t *dst, int count, int channel)
+{
+    for (int i=0; i < count; ++i, src += 3)
+        dst[i] = src[channel];
+}
+
+#ifdef IMAGE_SSSE3
+// 16 pixels at a time: three 16-byte input registers to one output register,
+// each output byte picked by a pshufb of whichever input holds its source
+#ifdef __GNUC__
+__attribute__((target("ssse3")))
+#endif
+static void extractChannelSSSE3(const uint8_t *src, uint8_t *dst, int count, int channel)
+{
+    // shuffle[in] picks bytes of input register in
+    alignas(16) uint8_t shuffle[3][16];
+    for (int in=0; in < 3; ++in)
+        for (int b=0; b < 16; ++b) {
+            int source = b*3 + channel - in*16;
+            shuffle[in][b] = source >= 0 && source < 16 ? uint8_t(source) : 0x80;
+        }
+    __m128i mask0 = _mm_load_si128((const __m128i*)shuffle[0]);
+    __m128i mask1 = _mm_load_si128((const __m128i*)shuffle[1]);
+    __m128i mask2 = _mm_load_si128((const __m128i*)shuffle[2]);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16, src += 48) {
+        __m128i in0 = _mm_loadu_si128((const __m128i*)(src));
+        __m128i in1 = _mm_loadu_si128((const __m128i*)(src + 16));
+        __m128i in2 = _mm_loadu_si128((const __m128i*)(src + 32));
+        __m128i result = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(in0, mask0), _mm_shuffle_epi8(in1, mask1)),
+            _mm_shuffle_epi8(in2, mask2));
+        _mm_storeu_si128((__m128i*)(dst + i), result);
+    }
+    extractChannelScalar(src, dst + i, count - i, channel);
+}
+
+// check once whether this CPU has SSSE3
+static bool haveSSSE3()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    static bool have = (info[2] & (1 << 9)) != 0;
+#else
+    static bool have = __builtin_cpu_supports("ssse3");
+#endif
+    return have;
+}
+#endif
+
+// copy one channel of count RGB pixels into a single byte per pixel
+static void extractChannel(const uint8_t *src, uint8_t *dst, int count, int channel)
+{
+#ifdef IMAGE_SSSE3
+    if (haveSSSE3()) {
+        extractChannelSSSE3(src, dst, count, channel);
+        return;
+    }
+#endif
+    extractChannelScalar(src, dst, count, channel);
+}
+
+Image::Image(std::string imagefile, int channel)
+    : width(0), height(0), components(channel == -1 ? 3 : 1)
+{
+    // open file in project data directory
+    std::filesystem::path ppmPath(imagefile);
+    if (ppmPath.is_relative()) ppmPath = std::filesystem::path(PROJECT_DATA_DIR) / ppmPath;
+    MappedFile file(ppmPath.u8string().c_str());
+    assert(file);
+
+    // check that "magic number" at beginning of file is P6
+    const char *p = file.begin(), *end = file.end();
+    if (file.size < 2 || p[0] != 'P' || p[1] != '6') {
+        fprintf(stderr, "unknown image format %s\n", ppmPath.string().c_str());
+        assert(false);
+        return;
+    }
+    p += 2;
+
+    // read image size and maximum value, with optional comments between
+    int maxval = 0;
+    bool ok = headerNumber(p, end, width) && headerNumber(p, end, height)
+        && headerNumber(p, end, maxval);
+    assert(ok && width > 0 && height > 0);
+    assert(maxval == 255);
+
+    // single whitespace character before data
+    assert(p < end && (*p == '\n' || *p == ' ' || *p == '\r' || *p == '\t'));
+    ++p;
+
+    // check remaining file size matches image size
+    // if this fails, you may have checked a ppm file out
+    // as text rather than binary
+    size_t rowBytes = size_t(width) * 3;
+    assert(size_t(end - p) == rowBytes * height);
+    if (!ok || size_t(end - p) < rowBytes * height) {
+        width = height = 0;
+        return;
+    }
+
+    // copy straight out of the mapped file, flipping in y
+    pixels.resize(size_t(width) * height * components);
+    const uint8_t *src = (const uint8_t*)p;
+    for (int y=height-1; y >= 0; --y, src += rowBytes) {
+        uint8_t *dst = &pixels[size_t(y) * width * components];
+        if (channel == -1)
+            memcpy(dst, src, rowBytes);
+        else
+            extractChannel(src, dst, width, channel);
+    }
+}
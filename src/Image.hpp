@@ -0,0 +1,20 @@
+// decoded image data, independent of OpenGL
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+class Image {
+public:
+    int width, height;                  // image size
+    int components;                     // bytes per pixel: 3 for RGB, 1 for one channel
+    std::vector<uint8_t> pixels;        // bottom row first for OpenGL
+
+public:
+    // load a PPM image, relative paths are in the project data directory
+    // channel is -1 for use all channels, 0 for red, 1 for green, or 2 for blue
+    // single channel images store just that channel, one byte per pixel
+    Image(std::string imagefile, int channel = -1);
+};
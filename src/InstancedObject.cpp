@@ -0,0 +1,81 @@
+// object drawn many times in one instanced draw, with a transform and color per instance
+
+#include "InstancedObject.hpp"
+#include "GLState.hpp"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <math.h>
+#include <stddef.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+InstancedObject::InstancedObject(std::vector<std::string> textures, std::vector<int> channels)
+    : Object(textures, channels, "#define INSTANCED\n"), meshSphere(0, 0, 0, -1)
+{
+    glGenBuffers(1, &instanceBuffer);
+}
+
+InstancedObject::~InstancedObject()
+{
+    glDeleteBuffers(1, &instanceBuffer);
+    GLState::global().deletedBuffer(instanceBuffer);
+}
+
+void InstancedObject::uploadInstances()
+{
+    // orphan the old data, so there's no wait for draws still using it
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(Instance), instances.data(),
+        GL_DYNAMIC_DRAW);
+
+    // the mesh's own sphere, before it is replaced by the one around all instances
+    if (meshSphere.w < 0) meshSphere = boundingSphere;
+
+    // box around the mesh sphere of every instance
+    vec3 lo(INFINITY), hi(-INFINITY);
+    for (auto &instance : instances) {
+        const mat4 &M = instance.ModelFromInstance;
+        vec3 center = vec3(M * vec4(vec3(meshSphere), 1));
+        float scale = std::max(length(vec3(M[0])), std::max(length(vec3(M[1])), length(vec3(M[2]))));
+        lo = min(lo, center - meshSphere.w * scale);
+        hi = max(hi, center + meshSphere.w * scale);
+    }
+    if (instances.empty()) lo = hi = vec3(0);
+    boundsMin = lo;
+    boundsMax = hi;
+    boundingSphere = vec4(0.5f * (lo + hi), 0.5f * length(hi - lo));
+
+    // culled as one cluster, with no normal cone
+    clusters.assign(1, MeshCluster{0, unsigned(indices.size()), lo, hi, boundingSphere, vec3(0), 1});
+}
+
+void InstancedObject::initVertexArray()
+{
+    Object::initVertexArray();
+
+    // a mat4 attribute is four vec4 columns, each stepping once per instance
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (int col=0; col < 4; ++col) {
+        GLuint attrib = INSTANCE_ATTRIB + col;
+        glVertexAttribPointer(attrib, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+            (const void*)(offsetof(Instance, ModelFromInstance) + col * sizeof(vec4)));
+        glVertexAttribDivisor(attrib, 1);
+        glEnableVertexAttribArray(attrib);
+    }
+    glVertexAttribPointer(INSTANCE_COLOR_ATTRIB, 4, GL_FLOAT, GL_FALSE, sizeof(Instance),
+        (const void*)offsetof(Instance, Color));
+    glVertexAttribDivisor(INSTANCE_COLOR_ATTRIB, 1);
+    glEnableVertexAttribArray(INSTANCE_COLOR_ATTRIB);
+}
+
+void InstancedObject::drawElements() const
+{
+    if (instances.empty()) return;
+    if (occlusionQuery) glBeginConditionalRender(occlusionQuery, GL_QUERY_NO_WAIT);
+    for (size_t r=0; r < drawCounts.size(); ++r)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, drawCounts[r], GL_UNSIGNED_INT,
+            drawOffsets[r], GLsizei(instances.size()), baseVertex);
+    if (occlusionQuery) glEndConditionalRender();
+}
@@ -0,0 +1,37 @@
+// object drawn many times in one instanced draw, with a transform and color per instance
+#pragma once
+
+#include "Object.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+
+class InstancedObject : public Object {
+public:
+    // per-instance data, matching INSTANCED attributes in object.vert
+    // must be plain old data
+    struct Instance {
+        glm::mat4 ModelFromInstance;    // rotation, uniform scale, and translation
+        glm::vec4 Color;                // scales diffuse color (rgb)
+    };
+    std::vector<Instance> instances;
+
+private:
+    unsigned int instanceBuffer;        // GL copy of instances
+    glm::vec4 meshSphere;               // bounding sphere of one instance, w < 0 until known
+
+public:
+    // object with no instances yet, compiling INSTANCED program variants
+    // fill vert, norm, uv, indices, and instances, then initGPUData and uploadInstances
+    InstancedObject(std::vector<std::string> textures, std::vector<int> channels);
+    virtual ~InstancedObject();
+
+    // copy all instances to the GPU at once, after any change
+    // refits the object bounds and its one cluster around all instances
+    void uploadInstances();
+
+    // add per-instance attributes to the vertex array
+    virtual void initVertexArray() override;
+
+    // one instanced draw per visible range, normally just one
+    virtual void drawElements() const override;
+};
@@ -0,0 +1,63 @@
+// read-only access to an entire file as one block of memory
+
+#include "MappedFile.hpp"
+
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+// don't complain if we use standard IO functions instead of windows-only
+#pragma warning( disable: 4996 )
+#endif
+
+MappedFile::MappedFile(const char *filename) : data(nullptr), size(0), mapped(false)
+{
+#ifndef _WIN32
+    // map whole file, falling through to buffered read on any failure
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == 0 && statbuf.st_size > 0) {
+        void *map = mmap(nullptr, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // mostly read front to back: let the kernel read ahead
+            madvise(map, statbuf.st_size, MADV_SEQUENTIAL);
+            data = (const char*)map;
+            size = statbuf.st_size;
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (mapped) return;
+#endif
+
+    // buffered read fallback
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return;
+    fseek(fp, 0, SEEK_END);
+    long fileEnd = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (fileEnd > 0) {
+        buffer.resize(fileEnd);
+        buffer.resize(fread(buffer.data(), 1, fileEnd, fp));
+    }
+    fclose(fp);
+
+    static const char empty = 0;
+    data = buffer.empty() ? &empty : buffer.data();
+    size = buffer.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (mapped) munmap((void*)data, size);
+#endif
+}
@@ -0,0 +1,31 @@
+// read-only access to an entire file as one block of memory
+#pragma once
+
+#include <vector>
+#include <stddef.h>
+
+class MappedFile {
+public:
+    const char *data;           // file contents, nullptr if open failed
+    size_t size;                // file size in bytes
+    bool mapped;                // memory mapped or read into a buffer
+
+private:
+    std::vector<char> buffer;   // file contents if not mapped
+
+public:
+    // memory map the file where supported, otherwise read it all
+    MappedFile(const char *filename);
+    ~MappedFile();
+
+    // owns the mapping, so no copies
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // true if file was opened
+    explicit operator bool() const { return data != nullptr; }
+
+    // contents as a [begin, end) range
+    const char *begin() const { return data; }
+    const char *end() const { return data + size; }
+};
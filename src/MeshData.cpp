@@ -0,0 +1,206 @@
+// CPU-side mesh and material data, built without any GL calls
+
+#include "MeshData.hpp"
+#include "ThreadPool.hpp"
+
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <string.h>
+#include <math.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+// default white-ish diffuse with no texture maps
+MaterialData::MaterialData() :
+    Ka(0), Kd(0.5), Ks(0), Ns(0),
+    maps(std::vector<std::string>{"","","",""}), channels(std::vector<int>{-1,-1,-1,-1})
+{
+}
+
+void MeshData::finish()
+{
+    finishMesh(vert, norm, uv, indices);
+    clusterMesh(vert, indices, clusters);
+    OcclusionCuller::buildOccluders(vert, indices, occluders);
+}
+
+void finishMesh(std::vector<vec3> &vert, std::vector<vec3> &norm,
+    std::vector<vec2> &uv, const std::vector<unsigned int> &indices)
+{
+    // invent missing texture coordinate data
+    if (uv.size() == 0) {
+        uv.resize(vert.size());
+        memset(uv.data(), 0, uv.size() * sizeof(uv[0]));
+    }
+
+    // fill in missing normals
+    if (norm.size() == 0) {
+        // initialize to 0
+        norm.resize(vert.size());
+        memset(norm.data(), 0, norm.size() * sizeof(norm[0]));
+
+        // compute weighted face normal and add to each face vertex
+        for (int i=0; i < indices.size(); i += 3) {
+            int v0 = indices[i], v1 = indices[i+1], v2 = indices[i+2];
+            vec3 normal = cross(vert[v1] - vert[v0], vert[v2] - vert[v0]);
+            normal /= dot(normal, normal);
+            norm[v0] += normal;
+            norm[v1] += normal;
+            norm[v2] += normal;
+        }
+    }
+
+    // renormalize all normals
+    for (auto &n : norm)
+        n = normalize(n);
+}
+
+// spread low 10 bits of x out to every third bit
+static uint32_t spreadBits(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | x << 16) & 0x030000ff;
+    x = (x | x << 8)  & 0x0300f00f;
+    x = (x | x << 4)  & 0x030c30c3;
+    x = (x | x << 2)  & 0x09249249;
+    return x;
+}
+
+bool MeshCluster::backfacing(const vec3 &eye) const
+{
+    if (coneCutoff >= 1) return false;
+    vec3 toCenter = vec3(sphere) - eye;
+    return dot(toCenter, coneAxis) >= coneCutoff * length(toCenter) + sphere.w;
+}
+
+void clusterMesh(const std::vector<vec3> &vert,
+    std::vector<unsigned int> &indices, std::vector<MeshCluster> &clusters)
+{
+    const size_t targetSize = 128, minSize = 64, maxSize = 256;   // in triangles
+    size_t numTris = indices.size() / 3;
+    clusters.clear();
+    if (numTris == 0) return;
+
+    // Morton code of each triangle center in the mesh bounds
+    vec3 boundsMin(INFINITY), boundsMax(-INFINITY);
+    for (auto index : indices) {
+        boundsMin = min(boundsMin, vert[index]);
+        boundsMax = max(boundsMax, vert[index]);
+    }
+    vec3 scale = 1023.f / max(boundsMax - boundsMin, vec3(1e-20f));
+    std::vector<std::pair<uint32_t, uint32_t>> order(numTris);  // code, triangle
+    for (size_t t=0; t < numTris; ++t) {
+        vec3 center = (vert[indices[3*t]] + vert[indices[3*t+1]] + vert[indices[3*t+2]]) / 3.f;
+        uvec3 cell = uvec3(clamp((center - boundsMin) * scale, vec3(0), vec3(1023)));
+        order[t] = std::make_pair(spreadBits(cell.x) | spreadBits(cell.y) << 1 | spreadBits(cell.z) << 2,
+            uint32_t(t));
+    }
+    std::sort(order.begin(), order.end());
+
+    std::vector<unsigned int> sorted(indices.size());
+    for (size_t t=0; t < numTris; ++t)
+        for (int i=0; i < 3; ++i)
+            sorted[3*t + i] = indices[3*order[t].second + i];
+    indices.swap(sorted);
+
+    // fixed-size runs along the curve, folding a short last run into the one before
+    std::vector<size_t> starts;
+    for (size_t t=0; t < numTris; t += targetSize) starts.push_back(t);
+    if (starts.size() > 1 && numTris - starts.back() < minSize
+        && numTris - starts[starts.size() - 2] <= maxSize)
+        starts.pop_back();
+    starts.push_back(numTris);
+
+    for (size_t c=0; c+1 < starts.size(); ++c) {
+        MeshCluster cluster;
+        cluster.firstIndex = unsigned(3 * starts[c]);
+        cluster.indexCount = unsigned(3 * (starts[c+1] - starts[c]));
+        const unsigned int *tri = &indices[cluster.firstIndex];
+
+        // bounds, then sphere around the box center
+        cluster.boundsMin = vec3(INFINITY); cluster.boundsMax = vec3(-INFINITY);
+        for (unsigned i=0; i < cluster.indexCount; ++i) {
+            cluster.boundsMin = min(cluster.boundsMin, vert[tri[i]]);
+            cluster.boundsMax = max(cluster.boundsMax, vert[tri[i]]);
+        }
+        vec3 center = 0.5f * (cluster.boundsMin + cluster.boundsMax);
+        float radius2 = 0;
+        for (unsigned i=0; i < cluster.indexCount; ++i)
+            radius2 = max(radius2, dot(vert[tri[i]] - center, vert[tri[i]] - center));
+        cluster.sphere = vec4(center, sqrtf(radius2));
+
+        // normal cone: average face normal, and the widest angle from it
+        std::vector<vec3> normals;
+        vec3 axis(0);
+        for (unsigned i=0; i < cluster.indexCount; i += 3) {
+            vec3 normal = cross(vert[tri[i+1]] - vert[tri[i]], vert[tri[i+2]] - vert[tri[i]]);
+            float len = length(normal);
+            if (len == 0) continue;
+            normals.push_back(normal / len);
+            axis += normals.back();
+        }
+        float minDot = -1;
+        if (length(axis) > 0) {
+            axis = normalize(axis);
+            minDot = 1;
+            for (auto &n : normals) minDot = min(minDot, dot(n, axis));
+        }
+        cluster.coneAxis = axis;
+        cluster.coneCutoff = minDot > 0 ? sqrtf(1 - minDot * minDot) : 1.f;
+        clusters.push_back(cluster);
+    }
+}
+
+void decodeTextures(std::vector<MeshData> &meshes, ThreadPool &pool,
+    const std::function<void(size_t)> &meshReady)
+{
+    // distinct (file, channel) pairs, in order of first use
+    std::map<std::pair<std::string, int>, int> keyIndex;
+    std::vector<std::pair<std::string, int>> keys;
+    std::vector<std::vector<int>> meshKeys(meshes.size());     // -1 for no map
+    for (size_t m=0; m < meshes.size(); ++m) {
+        const MaterialData &material = meshes[m].material;
+        for (size_t i=0; i < material.maps.size(); ++i) {
+            int key = -1;
+            if (!material.maps[i].empty()) {
+                auto found = keyIndex.emplace(std::make_pair(material.maps[i], material.channels[i]), int(keys.size()));
+                if (found.second) keys.push_back(found.first->first);
+                key = found.first->second;
+            }
+            meshKeys[m].push_back(key);
+        }
+    }
+
+    // share images with meshes, in order, as soon as all of a mesh's images are done
+    std::vector<std::shared_ptr<const Image>> images(keys.size());
+    std::vector<bool> decoded(keys.size(), false);
+    size_t nextMesh = 0;
+    std::mutex mutex;
+    auto releaseMeshes = [&]() {
+        for (; nextMesh < meshes.size(); ++nextMesh) {
+            for (int key : meshKeys[nextMesh])
+                if (key >= 0 && !decoded[key]) return;
+
+            MeshData &mesh = meshes[nextMesh];
+            mesh.images.resize(meshKeys[nextMesh].size());
+            for (size_t i=0; i < mesh.images.size(); ++i)
+                if (meshKeys[nextMesh][i] >= 0) mesh.images[i] = images[meshKeys[nextMesh][i]];
+            if (meshReady) meshReady(nextMesh);
+        }
+    };
+
+    // decode in parallel, roughly in order of first use
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        releaseMeshes();        // meshes with no textures at the start
+    }
+    pool.parallelFor(int(keys.size()), [&](int k) {
+        auto image = std::make_shared<const Image>(keys[k].first, keys[k].second);
+        std::lock_guard<std::mutex> lock(mutex);
+        images[k] = image;
+        decoded[k] = true;
+        releaseMeshes();
+    });
+}
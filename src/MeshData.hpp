@@ -0,0 +1,70 @@
+// CPU-side mesh and material data, built without any GL calls
+#pragma once
+
+#include "Image.hpp"
+#include "OcclusionCuller.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <memory>
+#include <functional>
+
+// surface material constants and texture maps
+struct MaterialData {
+    glm::vec3 Ka, Kd, Ks;               // ambient, diffuse, and specular color
+    float Ns;                           // specular exponent
+
+    // color, ambient, specular and gloss texture files ("" for none)
+    // channel is -1 for use all channels, 0 for red, 1 for green, or 2 for blue
+    std::vector<std::string> maps;
+    std::vector<int> channels;
+
+    MaterialData();
+};
+
+// spatially compact group of triangles, one range of a mesh's indices
+struct MeshCluster {
+    unsigned int firstIndex, indexCount;    // range of indices
+    glm::vec3 boundsMin, boundsMax;     // model-space bounding box
+    glm::vec4 sphere;                   // model-space center (xyz) and radius (w)
+    glm::vec3 coneAxis;                 // average triangle normal
+    float coneCutoff;                   // sine of normal cone half-angle, 1 for no cone
+
+    // true if every triangle faces away from a model-space eye point
+    bool backfacing(const glm::vec3 &eye) const;
+};
+
+// triangle mesh ready to hand to the GPU
+struct MeshData {
+    MaterialData material;
+
+    std::vector<glm::vec3> vert;        // per-vertex position
+    std::vector<glm::vec3> norm;        // per-vertex normal
+    std::vector<glm::vec2> uv;          // per-vertex texture coordinate
+    std::vector<unsigned int> indices;  // 3 vertex indices per triangle, in cluster order
+    std::vector<MeshCluster> clusters;  // covering all of indices
+    std::vector<OcclusionCuller::Occluder> occluders;  // triangles and quads for occlusion culling
+
+    // decoded material.maps, if loaded ahead of time (null if not)
+    // shared between meshes that use the same image and channel
+    std::vector<std::shared_ptr<const Image>> images;
+
+    // invent missing texture coordinates or normals, normalize normals,
+    // split into clusters, and find occluders
+    void finish();
+};
+
+// invent missing texture coordinates or normals, and normalize normals
+void finishMesh(std::vector<glm::vec3> &vert, std::vector<glm::vec3> &norm,
+    std::vector<glm::vec2> &uv, const std::vector<unsigned int> &indices);
+
+// reorder triangles into clusters of 64-256 nearby triangles
+// sorts by Morton code of triangle centers, so it is deterministic
+void clusterMesh(const std::vector<glm::vec3> &vert,
+    std::vector<unsigned int> &indices, std::vector<MeshCluster> &clusters);
+
+// decode all texture maps used by a set of meshes into their images arrays
+// each distinct image and channel is only loaded once, using the thread pool
+// if given, meshReady(m) is called in mesh order as soon as mesh m is done
+void decodeTextures(std::vector<MeshData> &meshes, class ThreadPool &pool,
+    const std::function<void(size_t)> &meshReady = nullptr);
@@ -2,40 +2,68 @@
 
 #include "NavMesh.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 using namespace glm;  // avoid glm:: for all glm types and functions
 using namespace std;  // avoid  on std types and functions
 
 
 // add data to trace against a triangle
 void NavMesh::addTriangle(vec3 v0, vec3 v1, vec3 v2)
+{
+    setTriangle(reserveTriangles(1), v0, v1, v2);
+}
+
+// grow lists to hold more triangles
+int NavMesh::reserveTriangles(int count)
+{
+    int first = int(plane.size());
+    bvh.clear();
+    bvhTriangles.clear();
+    plane.resize(first + count);
+    alpha.resize(first + count);
+    beta.resize(first + count);
+    return first;
+}
+
+// set data to trace against a triangle
+void NavMesh::setTriangle(int index, vec3 v0, vec3 v1, vec3 v2)
 {
     vec3 e0 = v1-v2, e1 = v2-v0, e2 = v0-v1;
     vec3 N = normalize(cross(e0, e1));
     vec3 Na = cross(N, e0), Nb = cross(N, e1);
     Na = Na / dot(Na,e2);   Nb = Nb / dot(Nb,e0);
 
-    plane.push_back(vec4(N, -dot(N, v0)));
-    alpha.push_back(vec4(Na,-dot(Na, v1)));
-    beta.push_back( vec4(Nb,-dot(Nb, v2)));
+    plane[index] = vec4(N, -dot(N, v0));
+    alpha[index] = vec4(Na,-dot(Na, v1));
+    beta[index]  = vec4(Nb,-dot(Nb, v2));
 }
 
-// find the closest intersection in the given normalized direction 
-float NavMesh::trace(vec3 start, vec3 direction, float near, float far) const
+// distance to triangle i if hit between near and far, or far if not
+float NavMesh::hitTriangle(int i, vec4 s, vec4 d, float near, float far) const
 {
-    vec4 s = vec4(start, 1), d = vec4(direction, 0);
-    for(int i=0; i<plane.size(); ++i) {
-        float t = -dot(plane[i], s) / dot(plane[i], d);
-        if (t < near || t > far) continue;
+    float t = -dot(plane[i], s) / dot(plane[i], d);
+    if (!(t >= near && t <= far)) return far;
 
-        vec4 p = vec4(start + t * direction, 1);
-        float a = dot(alpha[i], p);
-        if (a < 0 || a > 1) continue;
+    vec4 p = s + t * d;
+    float a = dot(alpha[i], p);
+    if (a < 0 || a > 1) return far;
 
-        float b = dot(beta[i], p);
-        if (b < 0 || a + b > 1) continue;
+    float b = dot(beta[i], p);
+    if (b < 0 || a + b > 1) return far;
 
-        far = t;
-    }
+    return t;
+}
+
+// find the closest intersection in the given normalized direction 
+float NavMesh::trace(vec3 start, vec3 direction, float near, float far) const
+{
+    if (!bvh.empty()) return traceBVH(start, direction, near, far, false);
+
+    vec4 s = vec4(start, 1), d = vec4(direction, 0);
+    for(int i=0; i<plane.size(); ++i)
+        far = hitTriangle(i, s, d, near, far);
 
     return far;
 }
@@ -44,23 +72,120 @@ float NavMesh::trace(vec3 start, vec3 direction, float near, float far) const
 // return true if there is any hit between near and far
 bool NavMesh::anyhit(vec3 start, vec3 direction, float near, float far) const
 {
+    if (!bvh.empty()) return traceBVH(start, direction, near, far, true) < far;
+
     vec4 s = vec4(start, 1), d = vec4(direction, 0);
-    for(int i=0; i<plane.size(); ++i) {
-        float t = -dot(plane[i], s) / dot(plane[i], d);
-        if (t < near || t > far) continue;
+    for(int i=0; i<plane.size(); ++i)
+        if (hitTriangle(i, s, d, near, far) < far) return true;
 
-        vec4 p = vec4(start + t * direction, 1);
-        float a = dot(alpha[i], p);
-        if (a < 0 || a > 1) continue;
+    return false;
+}
 
-        float b = dot(beta[i], p);
-        if (b < 0 || a + b > 1) continue;
+// each vertex is where the plane meets its barycentric values:
+// alpha is 1 at v0 and 0 at v1 and v2, beta is 1 at v1 and 0 at v2 and v0
+void NavMesh::triangleVertices(int i, vec3 v[3]) const
+{
+    mat3 M = transpose(mat3(vec3(plane[i]), vec3(alpha[i]), vec3(beta[i])));
+    mat3 inv = inverse(M);
+    v[0] = inv * vec3(-plane[i].w, 1 - alpha[i].w, -beta[i].w);
+    v[1] = inv * vec3(-plane[i].w, -alpha[i].w, 1 - beta[i].w);
+    v[2] = inv * vec3(-plane[i].w, -alpha[i].w, -beta[i].w);
+}
 
-        return true;
+void NavMesh::buildBVH()
+{
+    // triangle bounds, leaving out degenerate triangles that can never be hit
+    int count = int(plane.size());
+    vector<vec3> centers(count), boxMin(count), boxMax(count);
+    bvhTriangles.clear();
+    for (int i=0; i < count; ++i) {
+        vec3 v[3];
+        triangleVertices(i, v);
+        boxMin[i] = min(min(v[0], v[1]), v[2]);
+        boxMax[i] = max(max(v[0], v[1]), v[2]);
+        centers[i] = 0.5f * (boxMin[i] + boxMax[i]);
+        bool finite = true;
+        for (int k=0; k < 3; ++k)
+            finite = finite && std::isfinite(boxMin[i][k]) && std::isfinite(boxMax[i][k]);
+        if (finite) bvhTriangles.push_back(i);
     }
 
-    return false;
+    bvh.clear();
+    if (bvhTriangles.empty()) return;
+    bvh.reserve(2 * bvhTriangles.size() / 4 + 1);
+    buildNode(0, int(bvhTriangles.size()), centers, boxMin, boxMax);
 }
 
+int NavMesh::buildNode(int first, int count, const vector<vec3> &centers,
+    const vector<vec3> &boxMin, const vector<vec3> &boxMax)
+{
+    const int leafSize = 4;
+
+    int index = int(bvh.size());
+    bvh.push_back(BVHNode{vec3(INFINITY), first, vec3(-INFINITY), count});
+    vec3 nodeMin(INFINITY), nodeMax(-INFINITY), centerMin(INFINITY), centerMax(-INFINITY);
+    for (int i = first; i < first + count; ++i) {
+        int tri = bvhTriangles[i];
+        nodeMin = min(nodeMin, boxMin[tri]);
+        nodeMax = max(nodeMax, boxMax[tri]);
+        centerMin = min(centerMin, centers[tri]);
+        centerMax = max(centerMax, centers[tri]);
+    }
+    bvh[index].boxMin = nodeMin;
+    bvh[index].boxMax = nodeMax;
+    if (count <= leafSize) return index;
+
+    // split at the median center along the widest axis of the centers
+    vec3 size = centerMax - centerMin;
+    int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+    auto begin = bvhTriangles.begin() + first, middle = begin + count / 2;
+    nth_element(begin, middle, begin + count, [&](int a, int b) {
+        return centers[a][axis] < centers[b][axis] || (centers[a][axis] == centers[b][axis] && a < b);
+    });
+
+    buildNode(first, count / 2, centers, boxMin, boxMax);
+    int right = buildNode(first + count / 2, count - count / 2, centers, boxMin, boxMax);
+    bvh[index].start = right;
+    bvh[index].count = 0;
+    return index;
+}
 
-
+float NavMesh::traceBVH(vec3 start, vec3 direction, float near, float far, bool anyHit) const
+{
+    vec4 s = vec4(start, 1), d = vec4(direction, 0);
+    vec3 invDir;
+    for (int i=0; i < 3; ++i)
+        invDir[i] = direction[i] != 0 ? 1.f / direction[i] : 1e30f;
+
+    // distance to enter a node's box, or INFINITY if missed before far
+    auto enter = [&](const BVHNode &node) {
+        vec3 t0 = (node.boxMin - start) * invDir, t1 = (node.boxMax - start) * invDir;
+        vec3 tmin = min(t0, t1), tmax = max(t0, t1);
+        float tenter = std::max(std::max(std::max(tmin.x, tmin.y), tmin.z), near);
+        float texit = std::min(std::min(std::min(tmax.x, tmax.y), tmax.z), far);
+        return tenter <= texit ? tenter : INFINITY;
+    };
+
+    int stack[64], top = 0;
+    if (enter(bvh[0]) == INFINITY) return far;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BVHNode &node = bvh[stack[--top]];
+        if (node.count) {
+            for (int i = node.start; i < node.start + node.count; ++i) {
+                float t = hitTriangle(bvhTriangles[i], s, d, near, far);
+                if (t < far && anyHit) return t;
+                far = t;
+            }
+            continue;
+        }
+
+        // visit the nearer child first
+        int left = int(&node - &bvh[0]) + 1, right = node.start;
+        float tleft = enter(bvh[left]), tright = enter(bvh[right]);
+        if (tleft > tright) { std::swap(left, right); std::swap(tleft, tright); }
+        if (tright < far) stack[top++] = right;
+        if (tleft < far) stack[top++] = left;
+    }
+    return far;
+}
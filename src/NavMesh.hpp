@@ -11,16 +11,50 @@ public:
 	std::vector<glm::vec4> alpha;	// Na and -dot(Na, v1)
 	std::vector<glm::vec4> beta;	// Nb and -dot(Nb, v2)
 
+    // bounding volume hierarchy, empty until buildBVH
+    // inner nodes have their left child next, and right child at start
+    struct BVHNode {
+        glm::vec3 boxMin; int start;    // leaf: first of bvhTriangles, inner: right child
+        glm::vec3 boxMax; int count;    // leaf: number of triangles, inner: 0
+    };
+    std::vector<BVHNode> bvh;
+    std::vector<int> bvhTriangles;      // triangle indices, grouped by leaf
+
 public:
 	NavMesh() {}
 
     // add a triangle to the lists
 	void addTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
 
+    // make space for count more triangles, returning index of the first
+    // these can then be filled in any order (or in parallel) by setTriangle
+    // any BVH is discarded
+    int reserveTriangles(int count);
+
+    // set data for one triangle
+    void setTriangle(int index, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2);
+
+    // build a BVH over all triangles so trace and anyhit don't test every one
+    void buildBVH();
+
     // return distance to first triangle in given normalized direction
 	float trace(glm::vec3 start, glm::vec3 direction, float near, float far) const;
 
     // return true if there is any hit in the normalized direction between near and far
     bool anyhit(glm::vec3 start, glm::vec3 direction, float near, float far) const;
+
+private:
+    // distance to triangle i if hit between near and far, or far if not
+    float hitTriangle(int i, glm::vec4 start, glm::vec4 direction, float near, float far) const;
+
+    // closest hit using the BVH, or any hit if anyHit is set
+    float traceBVH(glm::vec3 start, glm::vec3 direction, float near, float far, bool anyHit) const;
+
+    // vertices of triangle i, recovered from its planes
+    void triangleVertices(int i, glm::vec3 v[3]) const;
+
+    // build BVH nodes for bvhTriangles[first, first+count) and return the node index
+    int buildNode(int first, int count, const std::vector<glm::vec3> &centers,
+        const std::vector<glm::vec3> &boxMin, const std::vector<glm::vec3> &boxMax);
 };
 
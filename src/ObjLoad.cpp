@@ -1,22 +1,27 @@
 // Load and draw OBJ file
 #include "ObjLoad.hpp"
 
-#include "Object.hpp"
-#include "GLapp.hpp"
 #include "NavMesh.hpp"
+#include "MeshData.hpp"
+#include "SceneCache.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
 #include "config.h"
 
 #include <filesystem>
-#include <fstream>
 #include <iostream>
 #include <chrono>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <charconv>
 #include <map>
+#include <algorithm>
+#include <numeric>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
 #include <assert.h>
 
-#include <GL/glew.h>
-#include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
 
 
@@ -24,20 +29,8 @@ using namespace glm;  // avoid glm:: for all glm types and functions
 using namespace std;  // avoid  on std types and functions
 
 
-// obj file material
-struct Material {
-	vec3 Ka, Kd, Ks;
-	float Ns;
-	vector<string> maps;
-	vector<int> channels;
-
-	Material() : Ka(0), Kd(0.5), Ks(0), Ns(0), maps(vector<string>{"","","",""}), channels(vector<int>{-1,-1,-1,-1}) {}
-
-    static int channel(const char c);
-};
-
 // convert character designator to channel index
-int Material::channel(const char c)
+static int mapChannel(const char c)
 {
     switch(c) {
         case 'r': return 0;
@@ -47,171 +40,507 @@ int Material::channel(const char c)
     }
 }
 
-// Load from file name
-// Add to GLapp objects list
-// If navmesh isn't nullptr, add to navmesh data
-vec3 ObjLoad(GLapp &app, NavMesh *navmesh, const char *objFileName)
+// whitespace-separated tokens and numbers from one line of text
+// works directly on the line characters: never allocates or copies
+struct Tokenizer {
+    const char *p, *end;
+
+    Tokenizer(const char *begin, const char *end) : p(begin), end(end) {}
+
+    // skip blanks, return false if nothing is left
+    bool skip() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        return p < end;
+    }
+
+    // next whitespace-delimited token, empty at end of line
+    string_view token() {
+        skip();
+        const char *start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r') ++p;
+        return string_view(start, p - start);
+    }
+
+    // parse next number, return false if there isn't one
+    template <typename T>
+    bool number(T &value) {
+        if (!skip()) return false;
+        if (*p == '+') ++p;     // from_chars does not accept a leading +
+        from_chars_result result = from_chars(p, end, value);
+        if (result.ec != errc()) return false;
+        p = result.ptr;
+        return true;
+    }
+
+    // parse up to N numbers into a vector, return how many were found
+    template <typename V>
+    int numbers(V &value) {
+        int n = 0;
+        while (n < value.length() && number(value[n])) ++n;
+        return n;
+    }
+};
+
+// split next line off the front of a [p, end) file range
+// return false when there are no lines left
+static bool nextLine(const char *&p, const char *end, Tokenizer &line)
 {
-    auto startTime = chrono::high_resolution_clock::now();
+    if (p >= end) return false;
+    const char *eol = (const char*)memchr(p, '\n', end - p);
+    if (!eol) eol = end;
+    line = Tokenizer(p, eol);
+    p = eol + (eol < end);
+    return true;
+}
 
-    // regular expressions for parsing: static and optimize to only build once
-    static const regex re_map("(?:-imfchan\\s+(r|g|b)\\s+)?(\\S+)\\s*", regex::optimize);
-    static const regex re_farg("(\\d+)(?:/(\\d*)(?:/(\\d+))?)?", regex::optimize);
+// parse "v", "v/vt", "v//vn" or "v/vt/vn" into OBJ indices, 0 if missing
+static bool parseTuple(string_view tuple, int index[3])
+{
+    index[0] = index[1] = index[2] = 0;
+    const char *p = tuple.data(), *end = p + tuple.size();
+    for (int i=0; i < 3 && p < end; ++i) {
+        if (*p != '/') {
+            from_chars_result result = from_chars(p, end, index[i]);
+            if (result.ec != errc()) return false;
+            p = result.ptr;
+        }
+        if (p < end && *p++ != '/') return false;
+    }
+    return index[0] != 0;
+}
 
-    // map from material name to properties
-	map<string, Material> materialMap;
-	Material *currentMaterial = &materialMap[""];
+// parse texture map arguments: optional "-imfchan r|g|b", then file name
+static void parseMap(Tokenizer &tok, const filesystem::path &dir, string &map, int &channel)
+{
+    string_view arg = tok.token();
+    channel = -1;
+    if (arg == "-imfchan") {
+        string_view chan = tok.token();
+        channel = mapChannel(chan.empty() ? 0 : chan[0]);
+        arg = tok.token();
+    }
+    map = (dir / string(arg)).string();
+}
 
-	// map from face v/vt/vn string to vertex ID
-	map<string, int> vertexMap;
+// add all materials in an mtl file to the material map
+static void loadMaterials(const filesystem::path &mtlPath, map<string, MaterialData, less<>> &materialMap)
+{
+    MappedFile mtlFile(mtlPath.string().c_str());
+    assert(mtlFile);
+
+    MaterialData *newMaterial = nullptr;
+
+    const char *mtlPos = mtlFile.begin();
+    Tokenizer tok(mtlPos, mtlPos);
+    while (nextLine(mtlPos, mtlFile.end(), tok)) {
+        string_view keyword = tok.token();
+        vec3 color;
+
+        if (keyword == "newmtl")
+            newMaterial = &materialMap[string(tok.token())];
+        else if (keyword == "Ka" && tok.numbers(color) == 3)
+            newMaterial->Ka = color;
+        else if (keyword == "Kd" && tok.numbers(color) == 3)
+            newMaterial->Kd = color;
+        else if (keyword == "Ks" && tok.numbers(color) == 3)
+            newMaterial->Ks = color;
+        else if (keyword == "Ns")
+            tok.number(newMaterial->Ns);
+        else if (keyword == "map_Kd")
+            parseMap(tok, mtlPath.parent_path(), newMaterial->maps[0], newMaterial->channels[0]);
+        else if (keyword == "map_Ka")
+            parseMap(tok, mtlPath.parent_path(), newMaterial->maps[1], newMaterial->channels[1]);
+        else if (keyword == "map_Ks")
+            parseMap(tok, mtlPath.parent_path(), newMaterial->maps[2], newMaterial->channels[2]);
+        else if (keyword == "map_Ns")
+            parseMap(tok, mtlPath.parent_path(), newMaterial->maps[3], newMaterial->channels[3]);
+    }
+}
 
-	// open obj file, relative paths from project data directory
-    filesystem::path objPath(objFileName);
-    if (objPath.is_relative()) objPath = filesystem::path(PROJECT_DATA_DIR) / objPath;
-	ifstream objFile(objPath.string());
-	assert(objFile);
+// one face corner
+// index[] is 0-based into the v, vt, and vn lists for the whole file,
+// or into the lists for just this chunk if that bit of local is set
+struct Corner {
+    int index[3];
+    unsigned char present, local;   // bit masks for v, vt, vn
+};
 
-	// intermediate position, texture coordinate, and normal lists
-	Object *newobj = nullptr;
-	vector<vec3> v;
-	vector<vec2> vt;
-	vector<vec3> vn;
-    vec3 BoxMin = vec3(INFINITY), BoxMax = vec3(-INFINITY);
-
-	// parse a line at a time
-	string line;
-	while (getline(objFile, line)) {
-        const char *cline = line.c_str();
-        float x, y, z;
-        int pos0, pos1;
-        smatch match;
-        
-        // material library: parse 2nd file
-		if (pos1=0, sscanf(cline, " mtllib %n%*s%n", &pos0, &pos1), pos1>0) {
-			filesystem::path mtlPath = objPath.parent_path() / string(cline+pos0, pos1-pos0);
-			ifstream mtlFile(mtlPath.string());
-			assert(mtlFile);
-
-			Material *newMaterial = nullptr;
-
-			while (getline(mtlFile, line)) {
-                const char *cline = line.c_str();
-				if (pos1=0, sscanf(cline, " newmtl %n%*s%n", &pos0, &pos1), pos1>0)
-					newMaterial = &materialMap[string(cline+pos0, pos1-pos0)];
-				else if (sscanf(cline, " Ka %f %f %f", &x, &y, &z) == 3)
-                    newMaterial->Ka = vec3(x, y, z);
-                else if (sscanf(cline, " Kd %f %f %f", &x, &y, &z) == 3)
-                    newMaterial->Kd = vec3(x, y, z);
-                else if (sscanf(cline, " Ks %f %f %f", &x, &y, &z) == 3)
-                    newMaterial->Ks = vec3(x, y, z);
-                else if (sscanf(cline, " Ns %f", &x) == 1)
-                    newMaterial->Ns = x;
-                else if (pos1=0, sscanf(cline, " map_Kd %n%*s%n", &pos0, &pos1), pos1>0) {
-                    string line = string(cline + pos0);
-                    regex_match(line, match, re_map);
-                    newMaterial->maps[0] = (mtlPath.parent_path() / match[2].str()).string();
-                    newMaterial->channels[0] = Material::channel(match[1].str()[0]);
-                }
-                else if (pos1=0, sscanf(cline, " map_Ka %n%*s%n", &pos0, &pos1), pos1>0) {
-                    string line = string(cline + pos0);
-                    regex_match(line, match, re_map);
-                    newMaterial->maps[1] = (mtlPath.parent_path() / match[2].str()).string();
-                    newMaterial->channels[1] = Material::channel(match[1].str()[0]);
-                }
-                else if (pos1=0, sscanf(cline, " map_Ks %n%*s%n", &pos0, &pos1), pos1>0) {
-                    string line = string(cline + pos0);
-                    regex_match(line, match, re_map);
-                    newMaterial->maps[2] = (mtlPath.parent_path() / match[2].str()).string();
-                    newMaterial->channels[2] = Material::channel(match[1].str()[0]);
-                }
-                else if (pos1=0, sscanf(cline, " map_Ns %n%*s%n", &pos0, &pos1), pos1>0) {
-                    string line = string(cline + pos0);
-                    regex_match(line, match, re_map);
-                    newMaterial->maps[3] = (mtlPath.parent_path() / match[2].str()).string();
-                    newMaterial->channels[3] = Material::channel(match[1].str()[0]);
+// mtllib or usemtl line, to be processed in file order after parsing
+struct Marker {
+    int face;                       // number of chunk faces before this line
+    bool usemtl;                    // usemtl if true, mtllib if false
+    string_view name;
+};
+
+// results of parsing one newline-aligned piece of the obj file
+struct ObjChunk {
+    const char *begin, *end;        // file range for this chunk
+
+    vector<vec3> v;                 // positions, texture coordinates
+    vector<vec2> vt;                //   and normals in this chunk
+    vector<vec3> vn;
+    int offset[3];                  // v, vt, vn counts from prior chunks
+    vec3 BoxMin, BoxMax;
+
+    vector<Corner> corners;         // all face corners in order
+    vector<int> faces;              // first corner of each face, plus end
+    vector<Marker> markers;         // material lines in order
+    size_t lines;
+
+    // parse this chunk's range of the file
+    void parse();
+};
+
+void ObjChunk::parse()
+{
+    BoxMin = vec3(INFINITY); BoxMax = vec3(-INFINITY);
+    lines = 0;
+
+    const char *filePos = begin;
+    Tokenizer tok(filePos, filePos);
+    while (nextLine(filePos, end, tok)) {
+        ++lines;
+        string_view keyword = tok.token();
+
+        if (keyword == "v") {
+            vec3 newv;
+            if (tok.numbers(newv) == 3) {
+                BoxMin = min(BoxMin, newv);
+                BoxMax = max(BoxMax, newv);
+                v.push_back(newv);
+            }
+        }
+
+        else if (keyword == "vt") {
+            vec2 newvt;
+            if (tok.numbers(newvt) == 2)
+                vt.push_back(newvt);
+        }
+
+        else if (keyword == "vn") {
+            vec3 newvn;
+            if (tok.numbers(newvn) == 3)
+                vn.push_back(newvn);
+        }
+
+        else if (keyword == "f") {
+            faces.push_back(int(corners.size()));
+
+            // resolve indices as far as possible without knowing prior chunks
+            const size_t counts[3] = {v.size(), vt.size(), vn.size()};
+            string_view tuple;
+            while (!(tuple = tok.token()).empty()) {
+                Corner corner = {{0,0,0}, 0, 0};
+                int index[3];
+                if (!parseTuple(tuple, index)) break;
+                for (int i=0; i < 3; ++i) {
+                    if (index[i] == 0) continue;
+                    corner.present |= 1 << i;
+                    if (index[i] > 0)
+                        corner.index[i] = index[i] - 1;
+                    else {      // negative indices are relative to the current end
+                        corner.index[i] = int(counts[i]) + index[i];
+                        corner.local |= 1 << i;
+                    }
                 }
-			}
-		}
+                corners.push_back(corner);
+            }
+        }
 
-        // finalize prior object when switching materials
-        else if (pos1=0, sscanf(cline, " usemtl %n%*s%n", &pos0, &pos1), pos1>0) {
-			currentMaterial = &materialMap[string(cline+pos0, pos1-pos0)];
+        else if (keyword == "usemtl" || keyword == "mtllib")
+            markers.push_back(Marker{int(faces.size()), keyword == "usemtl", tok.token()});
+    }
+    faces.push_back(int(corners.size()));
+}
 
-			if (newobj) newobj->initGPUData();
-			newobj = nullptr;
+// run of faces from one chunk: [faceBegin, faceEnd)
+struct FaceRange {
+    int chunk, faceBegin, faceEnd;
+};
 
-			vertexMap.clear();
-		}
+// open-addressing hash table from v/vt/vn index triple to vertex ID
+struct VertexTable {
+    struct Entry {
+        int key[3];                 // v, vt, vn; -1 if missing
+        int id;                     // vertex ID, -1 if entry is empty
+    };
+    vector<Entry> entries;          // power of two size
+    uint32_t mask;                  // entries.size() - 1
+
+    // table for up to count keys, kept at most half full
+    VertexTable(size_t count) {
+        size_t size = 16;
+        while (size < 2 * count) size *= 2;
+        entries.assign(size, Entry{{-1,-1,-1}, -1});
+        mask = uint32_t(size - 1);
+    }
 
-        else if (sscanf(cline, " v %f %f %f", &x, &y, &z) == 3) {
-            vec3 newv = vec3(x, y, z);
-            BoxMin = min(BoxMin, newv);
-            BoxMax = max(BoxMax, newv);
-            v.push_back(newv);
+    // return existing ID for key, or add it with newID
+    int find(const int key[3], int newID) {
+        uint32_t hash = uint32_t(key[0]) * 0x9E3779B1u
+            ^ uint32_t(key[1]) * 0x85EBCA77u ^ uint32_t(key[2]) * 0xC2B2AE3Du;
+        hash ^= hash >> 15;
+        for (uint32_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+            Entry &entry = entries[slot];
+            if (entry.id < 0) {
+                entry = Entry{{key[0], key[1], key[2]}, newID};
+                return newID;
+            }
+            if (entry.key[0] == key[0] && entry.key[1] == key[1] && entry.key[2] == key[2])
+                return entry.id;
         }
+    }
+};
+
+// faces between usemtl lines, becoming one mesh
+struct ObjSegment {
+    MaterialData material;          // material in effect at first face
+    vector<FaceRange> ranges;       // faces in file order
+    size_t corners;                 // total face corners, for scheduling
+
+    // fill mesh vertex and index arrays
+    void build(const vector<ObjChunk> &chunks, const vector<vec3> &v,
+        const vector<vec2> &vt, const vector<vec3> &vn, MeshData &mesh) const;
+};
+
+void ObjSegment::build(const vector<ObjChunk> &chunks, const vector<vec3> &v,
+    const vector<vec2> &vt, const vector<vec3> &vn, MeshData &mesh) const
+{
+    // map from face v/vt/vn indices to vertex ID
+    // sized so it never needs to grow, even if every corner is unique
+    VertexTable vertexTable(corners);
+
+    for (auto &range : ranges) {
+        const ObjChunk &chunk = chunks[range.chunk];
+        for (int face = range.faceBegin; face < range.faceEnd; ++face) {
+            int vertexTuple[3];
+            for (int c = chunk.faces[face], i=0; c < chunk.faces[face+1]; ++c, ++i) {
+                const Corner &corner = chunk.corners[c];
+
+                // file-wide indices, so equivalent tuples match however they were written
+                int index[3];
+                for (int j=0; j < 3; ++j) {
+                    index[j] = !(corner.present & (1 << j)) ? -1
+                        : corner.index[j] + (corner.local & (1 << j) ? chunk.offset[j] : 0);
+                }
 
-        else if (sscanf(cline, " vt %f %f", &x, &y) == 2)
-            vt.push_back(vec2(x, y));
-
-        else if (sscanf(cline, " vn %f %f %f", &x, &y, &z) == 3)
-            vn.push_back(vec3(x, y, z));
-
-		else if (pos1=0, sscanf(cline, " f%n", &pos1), pos1>0) {
-			// set up new component object with current material
-			if (!newobj) {
-				newobj = new Object(currentMaterial->maps, currentMaterial->channels);
-				newobj->objectShaderData.Ambient = currentMaterial->Ka;
-				newobj->objectShaderData.Diffuse = currentMaterial->Kd;
-				newobj->objectShaderData.Specular = vec4(currentMaterial->Ks, currentMaterial->Ns);
-				app.objects.push_back(newobj);
-			}
-
-			// add to vertex and index lists
-			int vID, vtID, vnID, vertexTuple[3];
-            
-            cline += pos1;
-			for (int i=0; pos1=0, sscanf(cline, " %n%*s%n", &pos0, &pos1), pos1>0; ++i) {
-                string tuple(cline + pos0, pos1-pos0);
-                cline += pos1;
-                
                 // create new GPU vertex if we haven't seen this vertex tuple before
-				if (vertexMap.find(tuple) == vertexMap.end()) {
-					vertexMap[tuple] = newobj->vert.size();
-
-                    regex_match(tuple, match, re_farg);
-                    int nmatch = match.size();
-					newobj->vert.push_back(v[stoi(match[1])-1]);
-                    if (match.size() > 2 && match[2].length() > 0)
-                        newobj->uv.push_back(vt[stoi(match[2])-1]);
-                    if (match.size() > 3 && match[3].length() > 0)
-                        newobj->norm.push_back(vn[stoi(match[3])-1]);
-				}
-                
+                int newID = int(mesh.vert.size());
+                int id = vertexTable.find(index, newID);
+                if (id == newID) {
+                    mesh.vert.push_back(v[index[0]]);
+                    if (index[1] >= 0)
+                        mesh.uv.push_back(vt[index[1]]);
+                    if (index[2] >= 0)
+                        mesh.norm.push_back(vn[index[2]]);
+                }
+
                 // advance triangle fan
                 vertexTuple[1] = vertexTuple[2];
-                vertexTuple[2 * (i!=0)] = vertexMap[tuple];
-                
+                vertexTuple[2 * (i!=0)] = id;
+
                 // output next triangle in fan
                 if (i > 1) {
-                    newobj->indices.push_back(vertexTuple[0]);
-                    newobj->indices.push_back(vertexTuple[1]);
-                    newobj->indices.push_back(vertexTuple[2]);
-
-                    if (navmesh) 
-                        navmesh->addTriangle(
-                            newobj->vert[vertexTuple[0]],
-                            newobj->vert[vertexTuple[1]],
-                            newobj->vert[vertexTuple[2]]);
+                    mesh.indices.push_back(vertexTuple[0]);
+                    mesh.indices.push_back(vertexTuple[1]);
+                    mesh.indices.push_back(vertexTuple[2]);
+                }
+            }
+        }
+    }
+}
+
+// hash of all mesh vertex and index data
+// matching hashes mean identical meshes, regardless of how they were loaded
+static uint64_t meshHash(const MeshData *meshes, size_t numMeshes)
+{
+    uint64_t hash = 14695981039346656037ull;       // 64-bit FNV-1a basis
+    auto add = [&hash](const void *data, size_t size) {
+        const unsigned char *bytes = (const unsigned char*)data;
+        for (; size >= 8; size -= 8, bytes += 8) {
+            uint64_t word;
+            memcpy(&word, bytes, 8);
+            hash = (hash ^ word) * 1099511628211ull;
+        }
+        for (; size > 0; --size, ++bytes)
+            hash = (hash ^ *bytes) * 1099511628211ull;
+    };
+
+    for (size_t m=0; m < numMeshes; ++m) {
+        const MeshData &mesh = meshes[m];
+        add(mesh.vert.data(), mesh.vert.size() * sizeof(mesh.vert[0]));
+        add(mesh.norm.data(), mesh.norm.size() * sizeof(mesh.norm[0]));
+        add(mesh.uv.data(), mesh.uv.size() * sizeof(mesh.uv[0]));
+        add(mesh.indices.data(), mesh.indices.size() * sizeof(mesh.indices[0]));
+    }
+    return hash;
+}
+
+// shared thread pool, or a private one with a specific number of threads
+static ThreadPool &threadPool(unsigned threads, unique_ptr<ThreadPool> &localPool)
+{
+    if (threads == 0) return ThreadPool::global();
+    localPool = make_unique<ThreadPool>(threads);
+    return *localPool;
+}
+
+// Parse obj file into CPU-side meshes, one per usemtl, without any GL calls
+vec3 ObjParse(const char *objFileName, vector<MeshData> &meshes, NavMesh *navmesh,
+    unsigned threads, bool useCache)
+{
+    auto startTime = chrono::high_resolution_clock::now();
+    unique_ptr<ThreadPool> localPool;
+    ThreadPool &pool = threadPool(threads, localPool);
+    size_t meshBase = meshes.size();
+
+	// open obj file, relative paths from project data directory
+    filesystem::path objPath(objFileName);
+    if (objPath.is_relative()) objPath = filesystem::path(PROJECT_DATA_DIR) / objPath;
+
+    // skip parsing entirely if there is an up to date cache
+    filesystem::path cachePath = objPath;
+    cachePath += ".cache";
+    vec3 BoxMin, BoxMax;
+    if (useCache && loadSceneCache(cachePath, meshes, navmesh, BoxMin, BoxMax)) {
+        size_t numMeshes = meshes.size() - meshBase;
+        pool.parallelFor(int(numMeshes), [&](int m) { meshes[meshBase + m].finish(); });
+
+        chrono::duration<float> elapsed = chrono::high_resolution_clock::now() - startTime;
+        cout << objFileName << " parse from cache in " << elapsed.count() << " seconds\n";
+        cout << "  " << numMeshes << " meshes, mesh hash "
+             << hex << meshHash(&meshes[meshBase], numMeshes) << dec << "\n";
+        return BoxMax - BoxMin;
+    }
+
+	MappedFile objFile(objPath.string().c_str());
+	assert(objFile);
+
+    // split into newline-aligned chunks, a few per thread for load balance
+    const size_t minChunk = 1 << 20;
+    size_t numChunks = pool.size() == 1 ? 1
+        : std::min(size_t(pool.size()) * 4, objFile.size / minChunk + 1);
+    vector<ObjChunk> chunks(numChunks);
+    const char *chunkPos = objFile.begin();
+    for (size_t c=0; c < numChunks; ++c) {
+        chunks[c].begin = chunkPos;
+        chunkPos = std::max(chunkPos, objFile.begin() + objFile.size * (c+1) / numChunks);
+        if (chunkPos < objFile.end()) {
+            const char *eol = (const char*)memchr(chunkPos, '\n', objFile.end() - chunkPos);
+            chunkPos = eol ? eol + 1 : objFile.end();
+        }
+        chunks[c].end = chunkPos;
+    }
+
+    // parse chunks in parallel
+    pool.parallelFor(int(numChunks), [&](int c) { chunks[c].parse(); });
+
+	// merge position, texture coordinate, and normal lists
+	vector<vec3> v;
+	vector<vec2> vt;
+	vector<vec3> vn;
+    BoxMin = vec3(INFINITY); BoxMax = vec3(-INFINITY);
+    size_t lines = 0;
+    for (auto &chunk : chunks) {
+        chunk.offset[0] = int(v.size());
+        chunk.offset[1] = int(vt.size());
+        chunk.offset[2] = int(vn.size());
+        v.insert(v.end(), chunk.v.begin(), chunk.v.end());
+        vt.insert(vt.end(), chunk.vt.begin(), chunk.vt.end());
+        vn.insert(vn.end(), chunk.vn.begin(), chunk.vn.end());
+        BoxMin = min(BoxMin, chunk.BoxMin);
+        BoxMax = max(BoxMax, chunk.BoxMax);
+        lines += chunk.lines;
+    }
+
+    // walk faces and material lines in file order, grouping faces into
+    // meshes that each start at the first face after a usemtl
+	map<string, MaterialData, less<>> materialMap;
+	MaterialData *currentMaterial = &materialMap[""];
+    vector<filesystem::path> sourceFiles = {objPath};   // for cache validation
+    vector<ObjSegment> segments;
+    bool newSegment = true;
+    for (int c=0; c < int(numChunks); ++c) {
+        const ObjChunk &chunk = chunks[c];
+        int face = 0, numFaces = int(chunk.faces.size()) - 1;
+        for (size_t m=0; m <= chunk.markers.size(); ++m) {
+            int faceEnd = m < chunk.markers.size() ? chunk.markers[m].face : numFaces;
+            if (faceEnd > face) {
+                if (newSegment) {
+                    segments.push_back(ObjSegment{*currentMaterial, {}, 0});
+                    newSegment = false;
                 }
-			}
-		}
-	}
+                segments.back().ranges.push_back(FaceRange{c, face, faceEnd});
+                segments.back().corners += chunk.faces[faceEnd] - chunk.faces[face];
+                face = faceEnd;
+            }
+            if (m == chunk.markers.size()) break;
+
+            const Marker &marker = chunk.markers[m];
+            if (marker.usemtl) {
+                auto found = materialMap.find(marker.name);
+                if (found == materialMap.end())
+                    found = materialMap.emplace(string(marker.name), MaterialData()).first;
+                currentMaterial = &found->second;
+                newSegment = true;
+            }
+            else {
+                sourceFiles.push_back(objPath.parent_path() / string(marker.name));
+                loadMaterials(sourceFiles.back(), materialMap);
+            }
+        }
+    }
 
-	if (newobj) newobj->initGPUData();
+    // build meshes in parallel, biggest first
+    meshes.resize(meshBase + segments.size());
+    MeshData *newMeshes = &meshes[meshBase];
+    for (size_t s=0; s < segments.size(); ++s)
+        newMeshes[s].material = segments[s].material;
+
+    vector<int> order(segments.size());
+    iota(order.begin(), order.end(), 0);
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        return segments[a].corners > segments[b].corners;
+    });
+    pool.parallelFor(int(order.size()), [&](int i) {
+        segments[order[i]].build(chunks, v, vt, vn, newMeshes[order[i]]);
+    });
+
+    // add triangles to navmesh in file order
+    int navBase = navmesh ? int(navmesh->plane.size()) : 0;
+    if (navmesh) {
+        vector<int> first(segments.size());
+        int numTriangles = 0;
+        for (size_t s=0; s < segments.size(); ++s) {
+            first[s] = numTriangles;
+            numTriangles += int(newMeshes[s].indices.size() / 3);
+        }
+        navmesh->reserveTriangles(numTriangles);
+        pool.parallelFor(int(segments.size()), [&](int s) {
+            const MeshData &mesh = newMeshes[s];
+            for (size_t i=0; i < mesh.indices.size(); i += 3)
+                navmesh->setTriangle(navBase + first[s] + int(i / 3),
+                    mesh.vert[mesh.indices[i]],
+                    mesh.vert[mesh.indices[i+1]],
+                    mesh.vert[mesh.indices[i+2]]);
+        });
+    }
 
-    auto endTime = chrono::high_resolution_clock::now();
-    chrono::duration<float> elapsed = endTime - startTime;
-    cout << objFileName << " load in " << elapsed.count() << " seconds\n";
+    // save parsed data before finishing normals and texture coordinates
+    // so loading from cache produces exactly the same result
+    if (useCache && !saveSceneCache(cachePath, sourceFiles, newMeshes, segments.size(),
+            navmesh, navBase, BoxMin, BoxMax))
+        cerr << "could not write cache " << cachePath.string() << "\n";
+
+    pool.parallelFor(int(segments.size()), [&](int m) { newMeshes[m].finish(); });
+
+    // report parsing time and rate
+    chrono::duration<float> elapsed = chrono::high_resolution_clock::now() - startTime;
+    cout << objFileName << " parse in " << elapsed.count() << " seconds, "
+         << objFile.size / (1024.f * 1024.f) / elapsed.count() << " MB/s, "
+         << lines / elapsed.count() << " lines/s, "
+         << pool.size() << " threads, " << numChunks << " chunks\n";
+    cout << "  " << segments.size() << " meshes, mesh hash "
+         << hex << meshHash(newMeshes, segments.size()) << dec << "\n";
 
     return BoxMax - BoxMin;
 }
@@ -1,7 +1,14 @@
 // Load multiple components from obj file
+#pragma once
+
 #include <glm/glm.hpp>
+#include <vector>
 
-// Load from file name
-// Add to GLapp objects list
+// Parse obj file into CPU-side meshes, one per usemtl, without any GL calls
+// Appends to meshes, with normals and texture coordinates filled in
 // If navmesh isn't nullptr, add to navmesh data
-glm::vec3 ObjLoad(class GLapp &app, class NavMesh *navmesh, const char *objFileName);
+// Parse in parallel using all cores if threads = 0, or given thread count
+// If useCache, load from objFileName.cache if up to date, or save one after parsing
+// Returns size of scene bounding box
+glm::vec3 ObjParse(const char *objFileName, std::vector<struct MeshData> &meshes,
+    class NavMesh *navmesh, unsigned threads = 0, bool useCache = true);
@@ -2,14 +2,18 @@
 
 #include "Object.hpp"
 #include "GLapp.hpp"
+#include "TextureCache.hpp"
+#include "GLState.hpp"
+#include "UniformRing.hpp"
+#include "GeometryPool.hpp"
 #include "config.h"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
-#include <filesystem>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <assert.h>
 
 using namespace glm;  // avoid glm:: for all glm types and functions
@@ -19,21 +23,68 @@ using namespace glm;  // avoid glm:: for all glm types and functions
 #pragma warning( disable: 4996 )
 #endif
 
-Object::Object(std::vector<std::string> textures, std::vector<int> channels)
+Object::Object(std::vector<std::string> textures, std::vector<int> channels,
+    const std::string &defines)
 {
-    // create buffer objects to be used later
-    glGenTextures(NUM_TEXTURES, textureIDs);
-    glGenBuffers(NUM_BUFFERS, bufferIDs);
-    glGenVertexArrays(1, &varrayID);
+    initGLObjects();
+    shaderDefines = defines;
 
     // load color images into a named textures
     assert(textures.size() == channels.size());
     assert(textures.size() <= NUM_TEXTURES);
     int tex;
     for(tex=0; tex<textures.size(); ++tex)
-        loadPPM(textures[tex], textureIDs[tex], channels[tex]);
+        setTexture(tex, textures[tex], channels[tex]);
     for(; tex < NUM_TEXTURES; ++tex)
-        loadPPM("", 0, 0);
+        setTexture(tex, "");
+    selectProgram();
+}
+
+Object::Object(MeshData &&mesh)
+{
+    initGLObjects();
+    occluder = true;                            // scene meshes don't move
+    pooled = true;                              // and are never freed
+
+    // use decoded images where we have them, otherwise load now
+    const MaterialData &material = mesh.material;
+    assert(material.maps.size() == material.channels.size());
+    assert(material.maps.size() <= NUM_TEXTURES);
+    int tex;
+    for(tex=0; tex < material.maps.size(); ++tex) {
+        const Image *image = tex < mesh.images.size() ? mesh.images[tex].get() : nullptr;
+        setTexture(tex, material.maps[tex], material.channels[tex], image);
+    }
+    for(; tex < NUM_TEXTURES; ++tex)
+        setTexture(tex, "");
+    selectProgram();
+
+    objectShaderData.Ambient = material.Ka;
+    objectShaderData.Diffuse = material.Kd;
+    objectShaderData.Specular = vec4(material.Ks, material.Ns);
+
+    vert = std::move(mesh.vert);
+    norm = std::move(mesh.norm);
+    uv = std::move(mesh.uv);
+    indices = std::move(mesh.indices);
+    clusters = std::move(mesh.clusters);
+    occluders = std::move(mesh.occluders);
+    uploadGPUData();
+}
+
+void Object::initGLObjects()
+{
+    // buffer objects are created on upload unless pooled, textures come from the cache
+    for (auto &id : textureIDs) id = 0;
+    for (auto &id : bufferIDs) id = 0;
+    varrayID = 0;
+    pooled = false;
+    baseVertex = 0;
+    firstIndex = 0;
+
+    uniformsOffset = 0;
+    occluder = false;
+    occlusionQuery = 0;
 
     // default to position at origin, white ambient and diffuse, no specular
     objectShaderData = {
@@ -44,127 +95,107 @@ Object::Object(std::vector<std::string> textures, std::vector<int> channels)
         vec4(0)         // specular color & exponent
     };
 
-    // initial shader load
-    shaderParts = {
-        {glCreateShader(GL_VERTEX_SHADER  ), "object.vert"},
-        {glCreateShader(GL_FRAGMENT_SHADER), "object.frag"}
+    // shared shader programs, chosen once the textures are known
+    program = genericProgram = nullptr;
+    texelProgram = texelGenericProgram = nullptr;
+}
+
+bool Object::useVariants = true;
+bool Object::useIndirect = true;
+
+bool Object::usesObjectTexels() const
+{
+    return pooled && useIndirect && GeometryPool::global().hasObjectData(uniformsOffset);
+}
+
+bool Object::hasMap(int slot) const
+{
+    return textureIDs[slot] != TextureCache::global().placeholder();
+}
+
+void Object::selectProgram()
+{
+    // compile-time constants for object.frag in place of textureSize checks
+    static const char *mapDefines[NUM_TEXTURES] = {
+        "HAS_COLOR_MAP", "HAS_AMBIENT_MAP", "HAS_SPECULAR_MAP", "HAS_GLOSS_MAP"
     };
-    shaderID = glCreateProgram();
+    std::string defines = shaderDefines;
+    for (int i=0; i < NUM_TEXTURES; ++i)
+        defines += std::string("#define ") + mapDefines[i] + (hasMap(i) ? " true\n" : " false\n");
+
+    // programs are shared, so the first object to use one compiles it
+    program = ShaderProgram::get({"object.vert", "object.frag"}, defines, setupProgram);
+    genericProgram = ShaderProgram::get({"object.vert", "object.frag"}, shaderDefines, setupProgram);
+    if (!pooled) return;
+    texelProgram = ShaderProgram::get({"object.vert", "object.frag"},
+        defines + "#define OBJECT_TEXELS\n", setupProgram);
+    texelGenericProgram = ShaderProgram::get({"object.vert", "object.frag"},
+        shaderDefines + "#define OBJECT_TEXELS\n", setupProgram);
 }
 
 Object::~Object()
 {
-    for (auto shader : shaderParts)
-       glDeleteShader(shader.id);
-    glDeleteProgram(shaderID);
-    glDeleteTextures(NUM_TEXTURES, textureIDs);
+    for (auto id : textureIDs)
+        TextureCache::global().release(id);
+    if (pooled) return;                         // pool keeps the mesh
     glDeleteBuffers(NUM_BUFFERS, bufferIDs);
     glDeleteVertexArrays(1, &varrayID);
+    for (auto id : bufferIDs)
+        GLState::global().deletedBuffer(id);
+    GLState::global().deletedVertexArray(varrayID);
 }
 
 
-void Object::loadPPM(std::string imagefile, unsigned int bufferID, int channel)
+void Object::setTexture(int slot, std::string imagefile, int channel, const Image *image)
 {
-    // set active texture for later texture calls
-    glBindTexture(GL_TEXTURE_2D, bufferID);
-
-    // can detect 1x1 texture size in shader for missing texture
-    if (imagefile.size() == 0) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-        return;
-    }
-
-    // open file in project data directory
-    std::filesystem::path ppmPath(imagefile);
-    if (ppmPath.is_relative()) ppmPath = std::filesystem::path(PROJECT_DATA_DIR) / ppmPath;
-    FILE *fp = fopen(ppmPath.u8string().c_str(), "rb");
-    assert(fp);
-
-    // check that "magic number" at beginning of file is P6
-    if (fgetc(fp) != 'P' || fgetc(fp) != '6') {
-        fprintf(stderr, "unknown image format %s\n", ppmPath.string().c_str());
-        assert(false);
-    }
-
-    // read image size, maximum value, and blank following header
-    int width = 0, height = 0, maxval = 0, lf = 0;
-    fscanf(fp, " #%*[^\n]");                // skip comment (if there)
-    fscanf(fp, "%d %d", &width, &height);   // read image size
-    assert(width > 0 && height > 0);
-
-    fscanf(fp, " #%*[^\n]");                // skip comment (if there)
-    fscanf(fp, "%d", &maxval);              // skip max value
-    assert(maxval == 255);
-
-    lf = fgetc(fp);                         // skip final \n before data
-    assert(lf == '\n');
-
-    // check remaining file size matches image size
-    // if this fails, you may have checked a ppm file out
-    // as text rather than binary
-    long headerEnd = ftell(fp);
-    fseek(fp, 0, SEEK_END);
-    long fileEnd = ftell(fp);
-    fseek(fp, headerEnd, SEEK_SET);
-    assert(fileEnd - headerEnd == width*height*3);
-
-    // allocate image and read array, flipping in y
-    std::vector<u8vec3> image(width * height);
-    if (channel == -1) {    // read directly into image
-        for (int y=height-1; y >= 0; --y)
-            fread(&image[y * width], sizeof(u8vec3), width, fp);        
-    }
-    else {                  // read row then copy channel
-        std::vector<u8vec3> imgrow(width);
-        for (int y=height-1; y >= 0; --y) {
-            fread(&imgrow[0], sizeof(u8vec3), width, fp);
-            for (int x=0; x < width; ++x) {
-                image[y * width + x] = u8vec3(imgrow[x][channel]);        
-            }
-        }
-    }
-    fclose(fp);
+    assert(slot >= 0 && slot < NUM_TEXTURES);
+    TextureCache &cache = TextureCache::global();
+    unsigned int oldID = textureIDs[slot];
+    textureIDs[slot] = cache.acquire(imagefile, channel, image);
+    cache.release(oldID);
+
+    // after construction, a change of texture can change the variant
+    if (program) selectProgram();
+}
 
-    // load into texture
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, &image[0]);
-    glGenerateMipmap(GL_TEXTURE_2D);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+// complete and load vertex and index arrays to GPU
+void Object::initGPUData() 
+{
+    finishMesh(vert, norm, uv, indices);
+    uploadGPUData();
 }
 
 // load vertex and index arrays to GPU
-void Object::initGPUData() 
+void Object::uploadGPUData()
 {
-    // invent missing texture coordinate data
-    if (uv.size() == 0) {
-        uv.resize(vert.size());
-        memset(&uv[0], 0, uv.size() * sizeof(uv[0]));
+    if (clusters.empty()) clusterMesh(vert, indices, clusters);
+    if (pooled) {
+        GeometryPool &pool = GeometryPool::global();
+        pool.add(vert, norm, uv, indices, baseVertex, firstIndex);
+        varrayID = pool.vertexArray();
     }
-    
-    // fill in missing normals
-    if (norm.size() == 0) {
-        // initialize to 0
-        norm.resize(vert.size());
-        memset(&norm[0], 0, norm.size() * sizeof(norm[0]));
-        
-        // compute weighted face normal and add to each face vertex
-        for (int i=0; i < indices.size(); i += 3) {
-            int v0 = indices[i], v1 = indices[i+1], v2 = indices[i+2];
-            vec3 normal = cross(vert[v1] - vert[v0], vert[v2] - vert[v0]);
-            normal /= dot(normal, normal);
-            norm[v0] += normal;
-            norm[v1] += normal;
-            norm[v2] += normal;
-        }
+    std::vector<char> allVisible(clusters.size(), 1);
+    setVisibleClusters(allVisible.data());
+
+    // model-space bounds: box, then sphere around the box center
+    boundsMin = vec3(INFINITY); boundsMax = vec3(-INFINITY);
+    for (auto &v : vert) {
+        boundsMin = min(boundsMin, v);
+        boundsMax = max(boundsMax, v);
     }
-    
-    // renormalize all normals
-    for (auto &n : norm)
-        n = normalize(n);
-    
-    // update buffer data to GPU
-    glBindBuffer(GL_UNIFORM_BUFFER, bufferIDs[OBJECT_UNIFORM_BUFFER]);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(ObjectShaderData), &objectShaderData, GL_STREAM_DRAW);
+    if (vert.empty()) boundsMin = boundsMax = vec3(0);
+    vec3 center = 0.5f * (boundsMin + boundsMax);
+    float radius2 = 0;
+    for (auto &v : vert)
+        radius2 = max(radius2, dot(v - center, v - center));
+    boundingSphere = vec4(center, sqrtf(radius2));
+    if (pooled) return;
 
+    // update buffer data to GPU
+    if (!varrayID) {
+        glGenBuffers(NUM_BUFFERS, bufferIDs);
+        glGenVertexArrays(1, &varrayID);
+    }
     glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
     glBufferData(GL_ARRAY_BUFFER, vert.size() * sizeof(vert[0]), &vert[0], GL_STATIC_DRAW);
 
@@ -174,73 +205,142 @@ void Object::initGPUData()
     glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[UV_BUFFER]);
     glBufferData(GL_ARRAY_BUFFER, uv.size() * sizeof(uv[0]), &uv[0], GL_STATIC_DRAW);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(indices[0]), &indices[0], GL_STATIC_DRAW);
+    // copy target, so whichever vertex array is bound keeps its element buffer
+    glBindBuffer(GL_COPY_WRITE_BUFFER, bufferIDs[INDEX_BUFFER]);
+    glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(indices[0]), &indices[0], GL_STATIC_DRAW);
 
-    updateShaders();
+    initVertexArray();
 }
 
-// load or replace object shaders
-void Object::updateShaders()
+// set up a newly linked object program
+void Object::setupProgram(unsigned int shaderID)
 {
-    loadShaders(shaderID, shaderParts);
-    glUseProgram(shaderID);
+    GLState::global().useProgram(shaderID);
 
     // Bind uniform block #s to their shader names. Indices should match glBindBufferBase in draw
+    // ObjectData is missing from OBJECT_TEXELS programs
     glUniformBlockBinding(shaderID, glGetUniformBlockIndex(shaderID,"SceneData"),  0);
-    glUniformBlockBinding(shaderID, glGetUniformBlockIndex(shaderID,"ObjectData"), 1);
+    GLuint objectBlock = glGetUniformBlockIndex(shaderID, "ObjectData");
+    if (objectBlock != GL_INVALID_INDEX)
+        glUniformBlockBinding(shaderID, objectBlock, 1);
 
     // Map shader name for textures. 0 says to use GL_TEXTURE0: should match setRenderState
     glUniform1i(glGetUniformLocation(shaderID, "ColorTexture"),    0);
     glUniform1i(glGetUniformLocation(shaderID, "AmbientTexture"),  1);
     glUniform1i(glGetUniformLocation(shaderID, "SpecularTexture"), 2);
     glUniform1i(glGetUniformLocation(shaderID, "GlossTexture"),    3);
+    glUniform1i(glGetUniformLocation(shaderID, "ObjectTexels"),    OBJECT_DATA_UNIT);
+}
 
+// connect object vertex arrays to shader attributes
+// fixed locations, so this doesn't need to wait for shaders to compile
+void Object::initVertexArray()
+{
     // bind attribute arrays
-    glBindVertexArray(varrayID);
+    GLState::global().bindVertexArray(varrayID);
 
-    GLint positionAttrib = glGetAttribLocation(shaderID, "vPosition");
+    GLint positionAttrib = POSITION_ATTRIB;
     glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[POSITION_BUFFER]);
     glVertexAttribPointer(positionAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(positionAttrib);
 
-    GLint normalAttrib = glGetAttribLocation(shaderID, "vNormal");
+    GLint normalAttrib = NORMAL_ATTRIB;
     glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[NORMAL_BUFFER]);
     glVertexAttribPointer(normalAttrib, 3, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(normalAttrib);
 
-    GLint uvAttrib = glGetAttribLocation(shaderID, "vUV");
+    GLint uvAttrib = UV_ATTRIB;
     glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[UV_BUFFER]);
     glVertexAttribPointer(uvAttrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
     glEnableVertexAttribArray(uvAttrib);
+
+    // element buffer is vertex array state, so draws need not bind it
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
 }
 
 // set shader, textures, etc. for this draw
 void Object::setRenderState(GLapp* app, double now)
 {
+    GLState &state = GLState::global();
+
     // enable shader
-    glUseProgram(shaderID);
+    state.useProgram(currentProgram()->id);
 
     // select vertex array to render
-    glBindVertexArray(varrayID);
+    state.bindVertexArray(varrayID);
 
     // bind textures to active texture slots
+    bindTextures();
+
+    // bind scene uniform buffer, then per-object state
+    state.bindBufferRange(0, app->uniforms->id(), app->sceneUniformsOffset, sizeof(GLapp::SceneShaderData));
+    setObjectState(app, now);
+}
+
+int Object::bindTextures() const
+{
+    // variants never sample missing maps, so those can be left alone
+    int bound = 0;
     for (int i=0; i < NUM_TEXTURES; ++i) {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_2D, textureIDs[i]);
+        if (useVariants && !hasMap(i)) continue;
+        if (GLState::global().bindTexture(i, textureIDs[i])) ++bound;
     }
+    return bound;
+}
 
-    // bind uniform buffers to the appropriate uniform block numbers
-    glBindBufferBase(GL_UNIFORM_BUFFER, 0, app->sceneUniformsID);
-    glBindBufferBase(GL_UNIFORM_BUFFER, 1, bufferIDs[OBJECT_UNIFORM_BUFFER]);
+void Object::setObjectState(GLapp* app, double now)
+{
+    // this object's part of the frame's uniform buffer
+    GLState::global().bindBufferRange(1, app->uniforms->id(), uniformsOffset, sizeof(ObjectShaderData));
+
+    // or the same data as texels, with the vertex array's texel array disabled
+    if (usesObjectTexels())
+        glVertexAttribI1ui(OBJECT_TEXEL_ATTRIB, GLuint(uniformsOffset / sizeof(vec4)));
+}
+
+void Object::update(GLapp* app, double now)
+{
+}
+
+bool Object::setVisibleClusters(const char *visible)
+{
+    drawCounts.clear();
+    drawOffsets.clear();
+    for (size_t c=0; c < clusters.size(); ++c) {
+        if (!visible[c]) continue;
+        const MeshCluster &cluster = clusters[c];
+        const void *offset = (const void*)((firstIndex + cluster.firstIndex) * sizeof(indices[0]));
+        if (c > 0 && visible[c-1] && !drawCounts.empty())
+            drawCounts.back() += cluster.indexCount;
+        else {
+            drawCounts.push_back(cluster.indexCount);
+            drawOffsets.push_back(offset);
+        }
+    }
+    drawBaseVertices.assign(drawCounts.size(), baseVertex);
+    return !drawCounts.empty();
+}
+
+void Object::drawElements() const
+{
+    if (occlusionQuery) glBeginConditionalRender(occlusionQuery, GL_QUERY_NO_WAIT);
+    if (drawCounts.size() == 1)
+        glDrawElementsBaseVertex(GL_TRIANGLES, drawCounts[0], GL_UNSIGNED_INT,
+            drawOffsets[0], baseVertex);
+    else if (!drawCounts.empty())
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(), GL_UNSIGNED_INT,
+            drawOffsets.data(), GLsizei(drawCounts.size()), drawBaseVertices.data());
+    if (occlusionQuery) glEndConditionalRender();
 }
 
 void Object::draw(GLapp* app, double now)
 {
+    // nothing to draw with until the shader program is ready
+    if (!currentProgram()->id) return;
+
     // set shader, textures & uniform buffers
     setRenderState(app, now);
 
     // draw the triangles
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[INDEX_BUFFER]);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    drawElements();
 }
@@ -2,6 +2,7 @@
 #pragma once
 
 #include "Shader.hpp"
+#include "MeshData.hpp"
 #include <glm/glm.hpp>
 #include <vector>
 #include <string>
@@ -17,6 +18,7 @@ public:
         glm::vec3 Diffuse; float pad1;  // diffuse color & padding
         glm::vec4 Specular;             // specular color (rgb) and exponent (w)
     } objectShaderData;
+    size_t uniformsOffset;              // objectShaderData in this frame's uniforms
 
     // arrays defining triangles for GPU
     unsigned int varrayID;              // GL vertex array object, containing:
@@ -24,39 +26,125 @@ public:
     std::vector<glm::vec3> norm;        //   per-vertex normal
     std::vector<glm::vec2> uv;          //   per-vertex texture coordinate
     std::vector<unsigned int> indices;  //   3 vertex indices per triangle
+    std::vector<MeshCluster> clusters;  // culled separately, covering indices
+    glm::vec3 boundsMin, boundsMax;     // model-space bounding box of vert
+    glm::vec4 boundingSphere;           // model-space center (xyz) and radius (w)
+
+    // static meshes live in the shared GeometryPool, using its vertex array
+    bool pooled;                        // set before uploadGPUData, never freed
+    int baseVertex;                     // pool offsets, 0 for the object's own buffers
+    unsigned int firstIndex;
+
+    bool occluder;                      // static, so it can hide other objects
+    std::vector<OcclusionCuller::Occluder> occluders;   // model-space, from MeshData
+    unsigned int occlusionQuery;        // skip drawing if this query saw nothing, 0 to always draw
+
+    // this frame's visible clusters as index ranges, merged where adjacent
+    // offsets include firstIndex, and every range uses baseVertex
+    std::vector<int> drawCounts;
+    std::vector<const void*> drawOffsets;
+    std::vector<int> drawBaseVertices;
 
     // GL texture ID(s), array for extensibility to more textures
     enum {COLOR_TEXTURE, AMBIENT_TEXTURE, SPECULAR_TEXTURE, GLOSS_TEXTURE, NUM_TEXTURES};
     unsigned int textureIDs[NUM_TEXTURES];
 
-    // GL buffer object IDs
-    enum {OBJECT_UNIFORM_BUFFER, POSITION_BUFFER, NORMAL_BUFFER, UV_BUFFER, INDEX_BUFFER, NUM_BUFFERS};
+    // GL buffer object IDs, all 0 for pooled objects
+    enum {POSITION_BUFFER, NORMAL_BUFFER, UV_BUFFER, INDEX_BUFFER, NUM_BUFFERS};
     unsigned int bufferIDs[NUM_BUFFERS];
 
-    // GL shaders
-    unsigned int shaderID;      // ID for shader program
-    std::vector<ShaderInfo> shaderParts;  // vertex & fragment shader info
+    // GL shaders, shared with other objects using the same program
+    ShaderProgram *program;             // variant for the maps this object has
+    ShaderProgram *genericProgram;      // checks for maps per fragment instead
+    ShaderProgram *texelProgram;        // same two, reading ObjectData from the
+    ShaderProgram *texelGenericProgram; //   object data texture for indirect draws
+    static bool useVariants;            // draw with program, or genericProgram
+    static bool useIndirect;            // pooled objects draw with texel programs
+    std::string shaderDefines;          // added to every program this object uses
+
+    // vertex attribute locations, matching layout(location) in object.vert
+    // the per-instance mat4 takes four locations, from INSTANCE_ATTRIB
+    enum {POSITION_ATTRIB, NORMAL_ATTRIB, UV_ATTRIB, OBJECT_TEXEL_ATTRIB,
+        INSTANCE_ATTRIB, INSTANCE_COLOR_ATTRIB = INSTANCE_ATTRIB + 4};
+
+    // texture unit for the object data texture buffer, after the map units
+    enum {OBJECT_DATA_UNIT = NUM_TEXTURES};
 
 public:
     // base object constructor: create buffers and textures
     // channel is -1 for use all channels, 0 for red, 1 for green, or 2 for blue
-    Object(std::vector<std::string> textures, std::vector<int> channels);
+    // defines are extra shader lines for every program variant
+    Object(std::vector<std::string> textures, std::vector<int> channels,
+        const std::string &defines = "");
+
+    // create object from finished CPU-side mesh, taking over its arrays
+    // uses any pre-decoded images, and uploads everything to the GPU
+    Object(MeshData &&mesh);
 
     // virtual destructor to delete any child class data
     virtual ~Object();
 
-    // load an image file into a texture object
-    void loadPPM(std::string imagefile, unsigned int bufferID, int channel = -1);
+    // use an image file for one texture slot, shared through the texture cache
+    // uses the already decoded image if given and the file isn't cached yet
+    // an empty file name gives a 1x1 texture, which the shader treats as missing
+    void setTexture(int slot, std::string imagefile, int channel = -1,
+        const Image *image = nullptr);
 
     // load GPU data after vert, norm, uv, and indices arrays are full
+    // fills in any missing normals or texture coordinates first
     void initGPUData();
 
-    // load/reload shaders
-    virtual void updateShaders();
+    // load GPU data from already finished vert, norm, uv, and indices arrays
+    // clusters the mesh first if it isn't already
+    void uploadGPUData();
+
+    // set this frame's draw ranges from one visibility flag per cluster
+    // return false if no clusters are visible
+    bool setVisibleClusters(const char *visible);
+
+    // connect vertex arrays to shader attributes
+    virtual void initVertexArray();
+
+    // choose the shader variants matching the textures this object has
+    void selectProgram();
+
+    // true if texture slot has a real map, not the 1x1 placeholder
+    bool hasMap(int slot) const;
+
+    // true if this frame's object data is read from the object data texture
+    bool usesObjectTexels() const;
+
+    // program to draw with this frame
+    ShaderProgram *currentProgram() const {
+        if (usesObjectTexels()) return useVariants ? texelProgram : texelGenericProgram;
+        return useVariants ? program : genericProgram;
+    }
+
+    // uniform block and sampler bindings, once for each linked program
+    static void setupProgram(unsigned int programID);
 
     // set shader, textures, etc. for this draw
     virtual void setRenderState(class GLapp *app, double now);
 
+    // bind textures this object's program uses
+    // return number actually bound, not counting any already current
+    int bindTextures() const;
+
+    // update objectShaderData on the CPU before each frame's uniforms are written
+    // override to animate objects
+    virtual void update(class GLapp *app, double now);
+
+    // set per-object state, once program, textures, and VAO are bound
+    virtual void setObjectState(class GLapp *app, double now);
+
+    // issue the draw call, once all state is set
+    // conditional on occlusionQuery, without waiting for its result
+    virtual void drawElements() const;
+
     // draw this object
     virtual void draw(class GLapp *app, double now);
+
+private:
+    // create GL objects and default shader data shared by all constructors
+    void initGLObjects();
 };
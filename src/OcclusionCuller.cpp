@@ -0,0 +1,400 @@
+// occlusion culling against a low-resolution depth buffer rasterized on the CPU
+
+#include "OcclusionCuller.hpp"
+#include "ThreadPool.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+// work sizes for the thread pool
+static const int setupChunk = 256;      // occluders per task
+static const int bandRows = 16;         // depth buffer rows per task
+static const int testChunk = 256;       // boxes per task
+
+// boxes must be this much nearer than the occluders to count as hidden,
+// so surfaces are never hidden by their own occluder triangles
+static const float depthBias = 1e-6f;
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+    : stats{0, 0, 0, 0, 0}, maxOccluders(4096), width(width), height(height), sorted(true)
+{
+    assert(width % 4 == 0 && width > 0 && height > 0);
+
+    // level 0 at full size, down to 1x1, all empty
+    for (int w = width, h = height; ; w = (w+1)/2, h = (h+1)/2) {
+        levels.push_back(std::vector<float>(size_t(w) * h, 1.f));
+        if (w == 1 && h == 1) break;
+    }
+    ProjFromWorld = mat4(1);
+}
+
+void OcclusionCuller::buildOccluders(const std::vector<vec3> &vert,
+    const std::vector<unsigned int> &indices, std::vector<Occluder> &occluders)
+{
+    // first triangle using each directed edge, keyed by its two vertex indices
+    size_t triangleCount = indices.size() / 3;
+    std::unordered_map<uint64_t, size_t> edgeTriangle;
+    for (size_t t=0; t < triangleCount; ++t)
+        for (int e=0; e < 3; ++e)
+            edgeTriangle.emplace(uint64_t(indices[3*t + e]) << 32 | indices[3*t + (e+1) % 3], t);
+
+    std::vector<char> used(triangleCount, 0);
+    auto triangle = [&](size_t t, vec3 tri[3]) {
+        for (int i=0; i < 3; ++i)
+            tri[i] = vert[indices[3*t + i]];
+    };
+    for (size_t t=0; t < triangleCount; ++t) {
+        if (used[t]) continue;
+        used[t] = 1;
+        Occluder occluder;
+        triangle(t, occluder.vert);
+        occluder.count = 3;
+        occluder.area = 0.5f * length(cross(occluder.vert[1] - occluder.vert[0],
+            occluder.vert[2] - occluder.vert[0]));
+        if (!(occluder.area > 0)) continue;
+
+        // an unused triangle across any edge, wound the same way
+        for (int e=0; e < 3 && occluder.count == 3; ++e) {
+            auto across = edgeTriangle.find(
+                uint64_t(indices[3*t + (e+1) % 3]) << 32 | indices[3*t + e]);
+            if (across == edgeTriangle.end() || used[across->second]) continue;
+            vec3 next[3];
+            triangle(across->second, next);
+            if (mergeTriangle(occluder, next)) used[across->second] = 1;
+        }
+        occluders.push_back(occluder);
+    }
+}
+
+void OcclusionCuller::addOccluders(const std::vector<Occluder> &modelOccluders,
+    const mat4 &WorldFromModel)
+{
+    // flatness and convexity survive the transform, but areas change
+    for (const Occluder &model : modelOccluders) {
+        Occluder occluder = model;
+        vec3 *v = occluder.vert;
+        for (int i=0; i < occluder.count; ++i)
+            v[i] = vec3(WorldFromModel * vec4(v[i], 1));
+        occluder.area = 0.5f * length(cross(v[1] - v[0], v[2] - v[0]));
+        if (occluder.count == 4)
+            occluder.area += 0.5f * length(cross(v[2] - v[0], v[3] - v[0]));
+        if (!(occluder.area > 0)) continue;
+        occluders.push_back(occluder);
+    }
+    sorted = false;
+}
+
+void OcclusionCuller::addOccluders(const std::vector<vec3> &vert,
+    const std::vector<unsigned int> &indices, const mat4 &WorldFromModel)
+{
+    std::vector<Occluder> modelOccluders;
+    buildOccluders(vert, indices, modelOccluders);
+    addOccluders(modelOccluders, WorldFromModel);
+}
+
+bool OcclusionCuller::mergeTriangle(Occluder &occluder, const vec3 next[3])
+{
+    const vec3 *v = occluder.vert;
+    vec3 normal = cross(v[1] - v[0], v[2] - v[0]);
+    float nextArea = 0.5f * length(cross(next[1] - next[0], next[2] - next[0]));
+    if (!(nextArea > 0)) return false;
+
+    // find edge p->q here and q->p in next, giving quad p, s, q, r
+    for (int e=0; e < 3; ++e) {
+        vec3 p = v[e], q = v[(e+1) % 3], r = v[(e+2) % 3];
+        for (int f=0; f < 3; ++f) {
+            if (next[f] != q || next[(f+1) % 3] != p) continue;
+            vec3 s = next[(f+2) % 3];
+            vec3 quad[4] = {p, s, q, r};
+
+            // flat, so one depth plane fits, and convex at every corner
+            if (fabsf(dot(normal, s - p)) > 1e-4f * length(normal) * length(s - p))
+                return false;
+            for (int c=0; c < 4; ++c) {
+                vec3 a = quad[c], b = quad[(c+1) % 4], d = quad[(c+2) % 4];
+                if (!(dot(cross(b - a, d - b), normal) > 0)) return false;
+            }
+            std::copy(quad, quad + 4, occluder.vert);
+            occluder.count = 4;
+            occluder.area += nextArea;
+            return true;
+        }
+    }
+    return false;
+}
+
+void OcclusionCuller::setupPolygon(int occluder)
+{
+    const Occluder &occ = occluders[occluder];
+    Polygon &poly = polygons[occluder];
+    poly.valid = false;
+
+    // clip to the near plane (z >= -w), adding at most one vertex
+    vec4 in[4], out[MAX_EDGES];
+    int count = 0;
+    for (int i=0; i < occ.count; ++i)
+        in[i] = ProjFromWorld * vec4(occ.vert[i], 1);
+    for (int i=0; i < occ.count; ++i) {
+        const vec4 &a = in[i], &b = in[(i+1) % occ.count];
+        float da = a.z + a.w, db = b.z + b.w;
+        if (da >= 0) out[count++] = a;
+        if ((da >= 0) != (db >= 0)) out[count++] = mix(a, b, da / (da - db));
+    }
+    if (count < 3) return;
+
+    // to pixel coordinates and [0,1] depth
+    vec3 screen[MAX_EDGES];
+    float area = 0;
+    for (int i=0; i < count; ++i) {
+        vec3 ndc = vec3(out[i]) / out[i].w;
+        screen[i] = vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height,
+            ndc.z * 0.5f + 0.5f);
+    }
+    for (int i=0; i < count; ++i) {
+        const vec3 &a = screen[i], &b = screen[(i+1) % count];
+        area += a.x * b.y - a.y * b.x;
+    }
+    if (fabsf(area) < 1e-6f) return;
+    if (area < 0) std::reverse(screen, screen + count);
+
+    // pixel bounds of anything the polygon might touch
+    vec3 lo = screen[0], hi = screen[0];
+    for (int i=1; i < count; ++i) {
+        lo = min(lo, screen[i]);
+        hi = max(hi, screen[i]);
+    }
+    poly.xmin = std::max(0, int(floorf(lo.x)));
+    poly.xmax = std::min(width - 1, int(floorf(hi.x)));
+    poly.ymin = std::max(0, int(floorf(lo.y)));
+    poly.ymax = std::min(height - 1, int(floorf(hi.y)));
+    poly.maxDepth = hi.z;
+    if (poly.xmin > poly.xmax || poly.ymin > poly.ymax || lo.z > 1)
+        return;
+
+    // edge functions, moved in by half a pixel so they are tested at the
+    // pixel's innermost corner when evaluated at its center
+    // only pixels the polygon covers entirely are written, since each one
+    // hides everything behind the whole pixel, including gaps between occluders
+    for (int e=0; e < count; ++e) {
+        const vec3 &a = screen[e], &b = screen[(e+1) % count];
+        vec3 edge(a.y - b.y, b.x - a.x, a.x * b.y - a.y * b.x);
+
+        // a slightly bent quad seen edge on may not project convex
+        for (int i=0; i < count; ++i)
+            if (edge.x * screen[i].x + edge.y * screen[i].y + edge.z
+                < -1e-3f * (fabsf(edge.x) + fabsf(edge.y)))
+                return;
+        edge.z -= 0.5f * (fabsf(edge.x) + fabsf(edge.y));
+        poly.edge[e] = edge;
+    }
+    poly.edges = count;
+
+    // depth plane through the widest fan triangle, raised to pass over every
+    // vertex, then moved back to its farthest value in a pixel
+    int widest = 1;
+    float det = 0;
+    for (int t=1; t+1 < count; ++t) {
+        const vec3 &v0 = screen[0], &v1 = screen[t], &v2 = screen[t+1];
+        float tdet = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (tdet > det) { det = tdet; widest = t; }
+    }
+    if (!(det > 1e-6f)) return;
+    const vec3 &v0 = screen[0], &v1 = screen[widest], &v2 = screen[widest+1];
+    float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / det;
+    float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / det;
+    float offset = v0.z - dzdx * v0.x - dzdy * v0.y;
+    for (int i=0; i < count; ++i)
+        offset = std::max(offset, screen[i].z - dzdx * screen[i].x - dzdy * screen[i].y);
+    poly.depth = vec3(dzdx, dzdy, offset + 0.5f * (fabsf(dzdx) + fabsf(dzdy)));
+    poly.valid = true;
+}
+
+void OcclusionCuller::rasterizeRows(int y0, int y1)
+{
+    std::vector<float> &buffer = levels[0];
+    for (const Polygon &poly : polygons) {
+        if (!poly.valid) continue;
+        int ystart = std::max(y0, poly.ymin), yend = std::min(y1 - 1, poly.ymax);
+        int xstart = poly.xmin & ~3;
+
+        for (int y = ystart; y <= yend; ++y) {
+            float cy = y + 0.5f;
+            float *row = &buffer[size_t(y) * width];
+            int x = xstart;
+#ifdef OCCLUSION_SSE2
+            // four pixels at a time: pass every edge, keep the nearer depth
+            __m128 erow[MAX_EDGES], ex[MAX_EDGES];
+            for (int e=0; e < poly.edges; ++e) {
+                erow[e] = _mm_set1_ps(poly.edge[e].y * cy + poly.edge[e].z);
+                ex[e] = _mm_set1_ps(poly.edge[e].x);
+            }
+            __m128 zrow = _mm_set1_ps(poly.depth.y * cy + poly.depth.z);
+            __m128 zx = _mm_set1_ps(poly.depth.x);
+            __m128 zmax = _mm_set1_ps(poly.maxDepth), zero = _mm_setzero_ps();
+            for (; x <= poly.xmax; x += 4) {
+                __m128 cx = _mm_add_ps(_mm_set1_ps(float(x)), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex[0], cx), erow[0]), zero);
+                for (int e=1; e < poly.edges; ++e)
+                    inside = _mm_and_ps(inside,
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(ex[e], cx), erow[e]), zero));
+                if (!_mm_movemask_ps(inside)) continue;
+                __m128 z = _mm_min_ps(_mm_add_ps(_mm_mul_ps(zx, cx), zrow), zmax);
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+#endif
+            // scalar version of the same loop
+            for (; x <= poly.xmax; ++x) {
+                float cx = x + 0.5f;
+                bool inside = true;
+                for (int e=0; e < poly.edges && inside; ++e)
+                    inside = poly.edge[e].x * cx + poly.edge[e].y * cy + poly.edge[e].z >= 0;
+                if (!inside) continue;
+                float z = std::min(poly.depth.x * cx + poly.depth.y * cy + poly.depth.z, poly.maxDepth);
+                row[x] = std::min(row[x], z);
+            }
+        }
+    }
+}
+
+void OcclusionCuller::render(const mat4 &newProjFromWorld, ThreadPool &pool)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    ProjFromWorld = newProjFromWorld;
+
+    // keep the largest occluders, ties in the order they were added
+    if (!sorted) {
+        std::stable_sort(occluders.begin(), occluders.end(),
+            [](const Occluder &a, const Occluder &b) { return a.area > b.area; });
+        if (occluders.size() > size_t(maxOccluders)) occluders.resize(maxOccluders);
+        sorted = true;
+    }
+
+    // set up screen polygons, then rasterize bands of rows
+    int count = int(occluders.size());
+    polygons.resize(count);
+    pool.parallelFor((count + setupChunk - 1) / setupChunk, [&](int chunk) {
+        int end = std::min(count, (chunk + 1) * setupChunk);
+        for (int o = chunk * setupChunk; o < end; ++o)
+            setupPolygon(o);
+    });
+    std::fill(levels[0].begin(), levels[0].end(), 1.f);
+    pool.parallelFor((height + bandRows - 1) / bandRows, [&](int band) {
+        rasterizeRows(band * bandRows, std::min(height, (band + 1) * bandRows));
+    });
+
+    // each Hi-Z texel is the farthest of the texels below it
+    int w = width, h = height;
+    for (size_t l=1; l < levels.size(); ++l) {
+        int pw = w, ph = h;
+        w = (w+1)/2; h = (h+1)/2;
+        const std::vector<float> &below = levels[l-1];
+        std::vector<float> &level = levels[l];
+        for (int y=0; y < h; ++y)
+            for (int x=0; x < w; ++x) {
+                int x0 = 2*x, x1 = std::min(2*x + 1, pw - 1);
+                int y0 = 2*y, y1 = std::min(2*y + 1, ph - 1);
+                level[size_t(y) * w + x] = std::max(
+                    std::max(below[size_t(y0) * pw + x0], below[size_t(y0) * pw + x1]),
+                    std::max(below[size_t(y1) * pw + x0], below[size_t(y1) * pw + x1]));
+            }
+    }
+
+    stats.occluders = int(std::count_if(polygons.begin(), polygons.end(),
+        [](const Polygon &poly) { return poly.valid; }));
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    stats.rasterMilliseconds = 1000 * elapsed.count();
+}
+
+int OcclusionCuller::addBox(const vec3 &boundsMin, const vec3 &boundsMax, const mat4 &WorldFromModel)
+{
+    // box of the transformed box
+    vec3 center = vec3(WorldFromModel * vec4(0.5f * (boundsMin + boundsMax), 1));
+    mat3 absM = mat3(abs(WorldFromModel[0]), abs(WorldFromModel[1]), abs(WorldFromModel[2]));
+    vec3 extent = absM * (0.5f * (boundsMax - boundsMin));
+    boxMin.push_back(center - extent);
+    boxMax.push_back(center + extent);
+    return int(boxMin.size()) - 1;
+}
+
+bool OcclusionCuller::boxVisible(const vec3 &worldMin, const vec3 &worldMax) const
+{
+    // screen rectangle and nearest depth of the corners
+    // anything reaching past the near plane counts as visible
+    vec2 lo(INFINITY), hi(-INFINITY);
+    float nearest = INFINITY;
+    for (int i=0; i < 8; ++i) {
+        vec3 corner(i & 1 ? worldMax.x : worldMin.x, i & 2 ? worldMax.y : worldMin.y,
+            i & 4 ? worldMax.z : worldMin.z);
+        vec4 clip = ProjFromWorld * vec4(corner, 1);
+        if (clip.z + clip.w <= 0 || clip.w <= 0) return true;
+        vec3 ndc = vec3(clip) / clip.w;
+        vec2 pixel((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height);
+        lo = min(lo, pixel);
+        hi = max(hi, pixel);
+        nearest = min(nearest, ndc.z * 0.5f + 0.5f);
+    }
+
+    // off screen is for frustum culling to decide
+    if (hi.x < 0 || hi.y < 0 || lo.x >= width || lo.y >= height) return true;
+    int x0 = std::max(0, int(floorf(lo.x))), x1 = std::min(width - 1, int(floorf(hi.x)));
+    int y0 = std::max(0, int(floorf(lo.y))), y1 = std::min(height - 1, int(floorf(hi.y)));
+
+    // coarsest level where the rectangle covers at most 4x4 texels
+    size_t l = 0;
+    while (l + 1 < levels.size() && ((x1 >> l) - (x0 >> l) > 3 || (y1 >> l) - (y0 >> l) > 3))
+        ++l;
+    int w = std::max(1, (width + (1 << l) - 1) >> l);
+    const std::vector<float> &level = levels[l];
+    for (int y = y0 >> l; y <= y1 >> l; ++y)
+        for (int x = x0 >> l; x <= x1 >> l; ++x)
+            if (nearest <= level[size_t(y) * w + x] + depthBias) return true;
+    return false;
+}
+
+void OcclusionCuller::test(std::vector<char> &visible, ThreadPool &pool)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+    int count = int(boxMin.size());
+    assert(visible.size() == boxMin.size());
+
+    int chunks = (count + testChunk - 1) / testChunk;
+    std::vector<int> tested(chunks, 0), occluded(chunks, 0);
+    pool.parallelFor(chunks, [&](int chunk) {
+        int end = std::min(count, (chunk + 1) * testChunk);
+        for (int i = chunk * testChunk; i < end; ++i) {
+            if (!visible[i]) continue;
+            ++tested[chunk];
+            if (!boxVisible(boxMin[i], boxMax[i])) {
+                visible[i] = 0;
+                ++occluded[chunk];
+            }
+        }
+    });
+
+    stats.tested = std::accumulate(tested.begin(), tested.end(), 0);
+    stats.occluded = std::accumulate(occluded.begin(), occluded.end(), 0);
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    stats.testMilliseconds = 1000 * elapsed.count();
+}
+
+void OcclusionCuller::report(const char *label) const
+{
+    printf("%s: %d occluders, %d of %d hidden (%.1f%%), %g ms raster, %g ms test per frame\n",
+        label, stats.occluders, stats.occluded, stats.tested,
+        stats.tested ? 100.0 * stats.occluded / stats.tested : 0.0,
+        stats.rasterMilliseconds, stats.testMilliseconds);
+}
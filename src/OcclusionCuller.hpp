@@ -0,0 +1,108 @@
+// occlusion culling against a low-resolution depth buffer rasterized on the CPU
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+class OcclusionCuller {
+public:
+    // per-frame counts and times
+    struct Stats {
+        int occluders;              // occluder polygons rasterized
+        int tested, occluded;       // bounding boxes tested, and found hidden
+        double rasterMilliseconds;  // rasterizing and building the Hi-Z
+        double testMilliseconds;
+    } stats;
+
+    int maxOccluders;               // largest occluders kept
+
+    // occluder triangle, or quad from two coplanar triangles sharing an edge
+    // so no crack is left between them
+    struct Occluder {
+        glm::vec3 vert[4];
+        int count;                  // 3 or 4 vertices
+        float area;
+    };
+
+    // depth buffer size, width a multiple of 4
+    const int width, height;
+
+private:
+    // world-space occluders, largest first once sorted
+    std::vector<Occluder> occluders;
+    bool sorted;
+
+    // screen-space convex polygons set up for this frame, clipped to the near plane
+    // edges and depth are planes a*x + b*y + c in pixel coordinates
+    enum {MAX_EDGES = 5};
+    struct Polygon {
+        glm::vec3 edge[MAX_EDGES];  // >= 0 for pixels entirely inside
+        int edges;
+        glm::vec3 depth;            // farthest depth of the plane in a pixel
+        float maxDepth;             // farthest vertex depth
+        int xmin, xmax, ymin, ymax; // pixel bounds, inclusive
+        bool valid;
+    };
+    std::vector<Polygon> polygons;
+
+    // Hi-Z pyramid: level 0 is the depth buffer, each level above holds the
+    // farthest depth of 2x2 texels below, all [0,1] with 1 for nothing drawn
+    std::vector<std::vector<float>> levels;
+    glm::mat4 ProjFromWorld;
+
+    // world-space boxes to test
+    std::vector<glm::vec3> boxMin, boxMax;
+
+public:
+    OcclusionCuller(int width = 256, int height = 128);
+
+    // find a mesh's occluders, pairing triangles that share an edge into quads
+    // where possible, in the mesh's own space
+    // uses no culler state, so it can run on loading threads
+    static void buildOccluders(const std::vector<glm::vec3> &vert,
+        const std::vector<unsigned int> &indices, std::vector<Occluder> &occluders);
+
+    // add occluders from buildOccluders to the candidates, moved to world space
+    // occluders are assumed not to move
+    void addOccluders(const std::vector<Occluder> &modelOccluders,
+        const glm::mat4 &WorldFromModel);
+
+    // build and add a mesh's occluders at once
+    void addOccluders(const std::vector<glm::vec3> &vert,
+        const std::vector<unsigned int> &indices, const glm::mat4 &WorldFromModel);
+
+    // rasterize the largest occluders for this view and build the Hi-Z
+    // rows are split into bands across the thread pool
+    void render(const glm::mat4 &ProjFromWorld, class ThreadPool &pool);
+
+    // start a new set of boxes to test
+    void clearBoxes() { boxMin.clear(); boxMax.clear(); }
+
+    // add a model-space box, transformed to a world-space box
+    // return index of this box in test results
+    int addBox(const glm::vec3 &boundsMin, const glm::vec3 &boundsMax,
+        const glm::mat4 &WorldFromModel);
+
+    // test boxes against the last render, in parallel
+    // boxes with visible[i] already 0 are skipped, hidden ones are set to 0
+    void test(std::vector<char> &visible, class ThreadPool &pool);
+
+    // depth buffer value at a pixel, for checking results
+    float depth(int x, int y) const { return levels[0][size_t(y) * width + x]; }
+
+    // print stats for the last frame
+    void report(const char *label) const;
+
+private:
+    // merge triangle next into a triangle occluder if they form a flat convex quad
+    static bool mergeTriangle(Occluder &occluder, const glm::vec3 next[3]);
+
+    // clip one occluder to the near plane and set up its screen polygon
+    void setupPolygon(int occluder);
+
+    // rasterize all polygons into rows [y0,y1) of the depth buffer
+    void rasterizeRows(int y0, int y1);
+
+    // false if a world-space box is certainly hidden
+    bool boxVisible(const glm::vec3 &worldMin, const glm::vec3 &worldMax) const;
+};
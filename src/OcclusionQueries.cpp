@@ -0,0 +1,147 @@
+// GPU occlusion queries on object bounding boxes, read back a frame late
+
+#include "OcclusionQueries.hpp"
+#include "Object.hpp"
+#include "GLapp.hpp"
+#include "GLState.hpp"
+#include "Shader.hpp"
+
+#include <GL/glew.h>
+
+#include <stdio.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+OcclusionQueries::OcclusionQueries()
+    : stats{0, 0, 0}, frame(0), programID(0), boxMinLocation(-1), boxMaxLocation(-1)
+{
+    program = ShaderProgram::get({"box.vert", "box.frag"}, "", Object::setupProgram);
+
+    // unit cube corners, bit i of the index is the coordinate on axis i
+    vec3 corners[8];
+    for (int i=0; i < 8; ++i)
+        corners[i] = vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+    unsigned int indices[36] = {
+        0,2,1, 1,2,3,   4,5,6, 5,7,6,   // -z, +z
+        0,1,4, 1,5,4,   2,6,3, 3,6,7,   // -y, +y
+        0,4,2, 2,4,6,   1,3,5, 3,7,5    // -x, +x
+    };
+
+    glGenBuffers(2, bufferIDs);
+    glGenVertexArrays(1, &varrayID);
+    GLState::global().bindVertexArray(varrayID);
+
+    glBindBuffer(GL_ARRAY_BUFFER, bufferIDs[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glVertexAttribPointer(Object::POSITION_ATTRIB, 3, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(Object::POSITION_ATTRIB);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferIDs[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+}
+
+OcclusionQueries::~OcclusionQueries()
+{
+    for (auto &query : queries)
+        glDeleteQueries(1, &query.second.id);
+    glDeleteBuffers(2, bufferIDs);
+    glDeleteVertexArrays(1, &varrayID);
+    for (auto id : bufferIDs)
+        GLState::global().deletedBuffer(id);
+    GLState::global().deletedVertexArray(varrayID);
+}
+
+bool OcclusionQueries::eyeNearBox(const GLapp *app, const Object *object)
+{
+    // a box this close may be cut by the near plane, and show nothing
+    // even when the object is in plain view
+    vec3 eye = vec3(object->objectShaderData.ModelFromWorld * vec4(app->position, 1));
+    vec3 margin(4 * app->near);
+    return all(greaterThanEqual(eye, object->boundsMin - margin))
+        && all(lessThanEqual(eye, object->boundsMax + margin));
+}
+
+void OcclusionQueries::begin(GLapp *app, bool enabled)
+{
+    ++frame;
+
+    // last frame's results, only if ready without waiting
+    stats = Stats{0, 0, 0};
+    for (auto &query : queries) {
+        if (query.second.frame != frame - 1) continue;
+        ++stats.issued;
+        GLint available = 0;
+        glGetQueryObjectiv(query.second.id, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+        ++stats.available;
+        GLint passed = 0;
+        glGetQueryObjectiv(query.second.id, GL_QUERY_RESULT, &passed);
+        if (passed) ++stats.visible;
+    }
+
+    // objects without a query last frame have no result to go on
+    for (auto object : app->objects) {
+        object->occlusionQuery = 0;
+        if (!enabled || eyeNearBox(app, object)) continue;
+        auto found = queries.find(object);
+        if (found != queries.end() && found->second.frame == frame - 1)
+            object->occlusionQuery = found->second.id;
+    }
+}
+
+void OcclusionQueries::issue(GLapp *app, double now)
+{
+    if (!program->id) return;
+    GLState &state = GLState::global();
+    state.useProgram(program->id);
+    state.bindVertexArray(varrayID);
+    if (programID != program->id) {
+        programID = program->id;
+        boxMinLocation = glGetUniformLocation(programID, "BoxMin");
+        boxMaxLocation = glGetUniformLocation(programID, "BoxMax");
+    }
+
+    // test against the finished depth buffer without changing anything
+    // the object's own surface is already there, and a flat object's box lies
+    // right on it, so boxes are padded and pass at equal depth
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_LEQUAL);
+    if (app->wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+
+    for (auto object : app->objects) {
+        if (object->drawCounts.empty() || eyeNearBox(app, object)) continue;
+        Query &query = queries[object];
+        if (!query.id) glGenQueries(1, &query.id);
+        query.frame = frame;
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, query.id);
+        object->setObjectState(app, now);
+        vec3 pad(max(0.001f * length(object->boundsMax - object->boundsMin), 0.01f * app->near));
+        vec3 boxMin = object->boundsMin - pad, boxMax = object->boundsMax + pad;
+        glUniform3fv(boxMinLocation, 1, &boxMin[0]);
+        glUniform3fv(boxMaxLocation, 1, &boxMax[0]);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    if (app->wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+}
+
+void OcclusionQueries::forget(const Object *object)
+{
+    auto found = queries.find(object);
+    if (found == queries.end()) return;
+    glDeleteQueries(1, &found->second.id);
+    queries.erase(found);
+}
+
+void OcclusionQueries::report(const char *label) const
+{
+    printf("%s: %d queries, %d ready, %d visible (%.1f%% hit rate) per frame\n",
+        label, stats.issued, stats.available, stats.visible,
+        stats.available ? 100.0 * stats.visible / stats.available : 0.0);
+}
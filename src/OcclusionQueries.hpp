@@ -0,0 +1,51 @@
+// GPU occlusion queries on object bounding boxes, read back a frame late
+#pragma once
+
+#include <unordered_map>
+
+class OcclusionQueries {
+public:
+    // last frame's queries, as far as their results were ready this frame
+    struct Stats {
+        int issued;                 // boxes drawn in queries
+        int available;              // results ready without waiting
+        int visible;                // ready results with any samples passed
+    } stats;
+
+private:
+    // query for each object that has had one
+    struct Query {
+        unsigned int id;
+        int frame;                  // frame it was last issued in
+    };
+    std::unordered_map<const class Object*, Query> queries;
+    int frame;
+
+    // unit cube, scaled to each box by the shader
+    class ShaderProgram *program;
+    unsigned int varrayID, bufferIDs[2];
+    unsigned int programID;         // program locations below are for
+    int boxMinLocation, boxMaxLocation;
+
+public:
+    OcclusionQueries();
+    ~OcclusionQueries();
+
+    // before drawing: condition each object's draw on its query from last
+    // frame, or set it to always draw if disabled or there isn't one
+    void begin(class GLapp *app, bool enabled);
+
+    // after drawing: draw boxes of all objects drawn this frame in queries,
+    // with color and depth writes off
+    void issue(class GLapp *app, double now);
+
+    // drop an object's query, before the object is deleted
+    void forget(const class Object *object);
+
+    // print stats for the last frame
+    void report(const char *label) const;
+
+private:
+    // true if the eye is too close to the object box for its query to be trusted
+    static bool eyeNearBox(const class GLapp *app, const class Object *object);
+};
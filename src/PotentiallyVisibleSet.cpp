@@ -0,0 +1,289 @@
+// precomputed sets of clusters visible from each cell of walkable space
+//
+// File layout, all in native byte order:
+//   PVSHeader
+//   int32_t set index for each cell, -1 for cells with nowhere to stand
+//   uint32_t bits for each distinct set, wordsPerSet words each
+
+#include "PotentiallyVisibleSet.hpp"
+#include "NavMesh.hpp"
+#include "ThreadPool.hpp"
+#include "MappedFile.hpp"
+#include "config.h"
+
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+#ifdef _WIN32
+// don't complain if we use standard IO functions instead of windows-only
+#pragma warning( disable: 4996 )
+#endif
+
+// change whenever the layout or bake output changes to invalidate old files
+static const uint32_t PVS_VERSION = 1;
+
+struct PVSHeader {
+    char magic[4];                  // "PVSB"
+    uint32_t version;               // PVS_VERSION
+    int32_t cellsX, cellsY;
+    int32_t numClusters, numSets;
+    vec2 origin;
+    float cellSize;
+    uint64_t clusterHash;
+};
+
+// bake settings
+static const float eyeHeight = 500;     // above the floor, as in GLapp::sceneUpdate
+static const int samplesPerSide = 2;    // eye positions per cell along x and y
+static const int maxFloors = 16;        // floors found under each sample
+static const int raysPerEye = 1024;
+
+PotentiallyVisibleSet::PotentiallyVisibleSet()
+    : origin(0), cellSize(0), cellsX(0), cellsY(0), numClusters(0), clusterHash(0), wordsPerSet(0)
+{
+}
+
+uint64_t PotentiallyVisibleSet::hashClusters(const std::vector<MeshCluster> &clusters, uint64_t hash)
+{
+    // 64-bit FNV-1a over the bounds
+    for (auto &cluster : clusters) {
+        const unsigned char *bytes[2] = {
+            (const unsigned char*)&cluster.boundsMin, (const unsigned char*)&cluster.boundsMax };
+        for (auto data : bytes)
+            for (size_t i=0; i < sizeof(vec3); ++i)
+                hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+void PotentiallyVisibleSet::bake(const std::vector<MeshData> &meshes, const NavMesh &navmesh,
+    float newCellSize, ThreadPool &pool)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    // all clusters, in the order objects will number them
+    std::vector<vec3> boxMin, boxMax;
+    clusterHash = hashClusters({});
+    for (auto &mesh : meshes) {
+        for (auto &cluster : mesh.clusters) {
+            boxMin.push_back(cluster.boundsMin);
+            boxMax.push_back(cluster.boundsMax);
+        }
+        clusterHash = hashClusters(mesh.clusters, clusterHash);
+    }
+    numClusters = int(boxMin.size());
+    wordsPerSet = (numClusters + 31) / 32;
+    cellSet.clear();
+    sets.clear();
+    if (numClusters == 0) return;
+
+    vec3 lo(INFINITY), hi(-INFINITY);
+    for (int c=0; c < numClusters; ++c) {
+        lo = min(lo, boxMin[c]);
+        hi = max(hi, boxMax[c]);
+    }
+    vec3 size = max(hi - lo, vec3(1e-6f));
+    float farDistance = 2 * length(size);
+    float epsilon = 1e-4f * length(size);
+
+    cellSize = newCellSize;
+    origin = vec2(lo);
+    cellsX = std::max(1, int(ceilf(size.x / cellSize)));
+    cellsY = std::max(1, int(ceilf(size.y / cellSize)));
+
+    // uniform grid listing the clusters touching each grid cell, to find
+    // which clusters a ray hit point is in
+    float gridCell = cbrtf(size.x * size.y * size.z / numClusters);
+    ivec3 dims = clamp(ivec3(ceil(size / gridCell)), ivec3(1), ivec3(128));
+    vec3 gridScale = vec3(dims) / size;
+    auto gridCoord = [&](vec3 p) { return clamp(ivec3((p - lo) * gridScale), ivec3(0), dims - 1); };
+    auto gridIndex = [&](ivec3 g) { return (size_t(g.z) * dims.y + g.y) * dims.x + g.x; };
+    std::vector<int> gridStart(size_t(dims.x) * dims.y * dims.z + 1, 0), gridClusters;
+    for (int pass=0; pass < 2; ++pass) {
+        std::vector<int> fill(gridStart.begin(), gridStart.end() - 1);
+        for (int c=0; c < numClusters; ++c) {
+            ivec3 g0 = gridCoord(boxMin[c] - epsilon), g1 = gridCoord(boxMax[c] + epsilon);
+            for (int z = g0.z; z <= g1.z; ++z)
+                for (int y = g0.y; y <= g1.y; ++y)
+                    for (int x = g0.x; x <= g1.x; ++x) {
+                        size_t g = gridIndex(ivec3(x, y, z));
+                        if (pass == 0) ++gridStart[g + 1];
+                        else gridClusters[fill[g]++] = c;
+                    }
+        }
+        if (pass == 0) {
+            for (size_t g=1; g < gridStart.size(); ++g) gridStart[g] += gridStart[g-1];
+            gridClusters.resize(gridStart.back());
+        }
+    }
+
+    // evenly spread ray directions
+    std::vector<vec3> directions(raysPerEye);
+    for (int i=0; i < raysPerEye; ++i) {
+        float z = 1 - (2 * i + 1) / float(raysPerEye);
+        float r = sqrtf(1 - z * z), phi = i * 2.39996323f;      // golden angle
+        directions[i] = vec3(r * cosf(phi), r * sinf(phi), z);
+    }
+
+    // each cell: find eyes above floors, mark clusters near the cell and hit by rays
+    int numCells = cellsX * cellsY;
+    std::vector<std::vector<uint32_t>> cellBitsList(numCells);
+    pool.parallelFor(numCells, [&](int cell) {
+        vec2 cellMin = origin + cellSize * vec2(cell % cellsX, cell / cellsX);
+        std::vector<vec3> eyes;
+        for (int s=0; s < samplesPerSide * samplesPerSide; ++s) {
+            vec2 xy = cellMin + cellSize * (vec2(s % samplesPerSide, s / samplesPerSide) + 0.5f)
+                / float(samplesPerSide);
+            vec3 start(xy, hi.z + 1);
+            for (int f=0; f < maxFloors; ++f) {
+                float t = navmesh.trace(start, vec3(0,0,-1), 0.f, farDistance);
+                if (t >= farDistance) break;
+                vec3 ground = start - vec3(0, 0, t);
+                if (!navmesh.anyhit(ground + vec3(0,0,1), vec3(0,0,1), 0.f, eyeHeight))
+                    eyes.push_back(ground + vec3(0, 0, eyeHeight));
+                start = ground - vec3(0,0,1);
+            }
+        }
+        if (eyes.empty()) return;
+
+        std::vector<uint32_t> &bits = cellBitsList[cell];
+        bits.assign(wordsPerSet, 0);
+        auto mark = [&](int c) { bits[c >> 5] |= 1u << (c & 31); };
+
+        // anything close to the cell, which sparse rays could miss
+        vec2 nearMin = cellMin - cellSize, nearMax = cellMin + 2 * cellSize;
+        for (int c=0; c < numClusters; ++c)
+            if (boxMax[c].x >= nearMin.x && boxMin[c].x <= nearMax.x
+                && boxMax[c].y >= nearMin.y && boxMin[c].y <= nearMax.y)
+                mark(c);
+
+        // clusters containing the first hit along each ray
+        for (auto &eye : eyes)
+            for (auto &direction : directions) {
+                float t = navmesh.trace(eye, direction, 0.f, farDistance);
+                if (t >= farDistance) continue;
+                vec3 hit = eye + t * direction;
+                size_t g = gridIndex(gridCoord(hit));
+                for (int i = gridStart[g]; i < gridStart[g+1]; ++i) {
+                    int c = gridClusters[i];
+                    if (all(greaterThanEqual(hit, boxMin[c] - epsilon))
+                        && all(lessThanEqual(hit, boxMax[c] + epsilon)))
+                        mark(c);
+                }
+            }
+    });
+
+    // share identical sets, numbered in cell order
+    std::map<std::vector<uint32_t>, int> setIndex;
+    cellSet.assign(numCells, -1);
+    size_t visibleTotal = 0;
+    int walkable = 0;
+    for (int cell=0; cell < numCells; ++cell) {
+        const std::vector<uint32_t> &bits = cellBitsList[cell];
+        if (bits.empty()) continue;
+        ++walkable;
+        for (auto word : bits)
+            for (; word; word &= word - 1) ++visibleTotal;
+        auto found = setIndex.emplace(bits, int(setIndex.size()));
+        if (found.second) sets.insert(sets.end(), bits.begin(), bits.end());
+        cellSet[cell] = found.first->second;
+    }
+
+    std::chrono::duration<float> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    printf("PVS bake in %g seconds: %d of %d cells walkable, %d distinct sets, "
+        "%.1f%% of %d clusters visible on average, %zu bytes\n",
+        elapsed.count(), walkable, numCells, int(setIndex.size()),
+        walkable ? 100.0 * visibleTotal / (double(walkable) * numClusters) : 0.0,
+        numClusters, bytes());
+}
+
+const uint32_t *PotentiallyVisibleSet::cellBits(const vec3 &position) const
+{
+    if (cellSet.empty()) return nullptr;
+    vec2 cell = floor((vec2(position) - origin) / cellSize);
+    if (cell.x < 0 || cell.y < 0 || cell.x >= cellsX || cell.y >= cellsY) return nullptr;
+    int set = cellSet[int(cell.y) * cellsX + int(cell.x)];
+    return set < 0 ? nullptr : &sets[size_t(set) * wordsPerSet];
+}
+
+// relative paths are from the project data directory
+static std::filesystem::path dataPath(const std::filesystem::path &path)
+{
+    return path.is_relative() ? std::filesystem::path(PROJECT_DATA_DIR) / path : path;
+}
+
+bool PotentiallyVisibleSet::save(const std::filesystem::path &relativePath) const
+{
+    std::filesystem::path path = dataPath(relativePath);
+
+    // write to temporary file, then rename so a partial file is never seen
+    std::filesystem::path tmpPath = path;
+    tmpPath += ".tmp";
+    FILE *fp = fopen(tmpPath.string().c_str(), "wb");
+    if (!fp) return false;
+
+    PVSHeader header;
+    memset(&header, 0, sizeof(header));         // no stray bytes in padding
+    memcpy(header.magic, "PVSB", 4);
+    header.version = PVS_VERSION;
+    header.cellsX = cellsX;
+    header.cellsY = cellsY;
+    header.numClusters = numClusters;
+    header.numSets = wordsPerSet ? int32_t(sets.size() / wordsPerSet) : 0;
+    header.origin = origin;
+    header.cellSize = cellSize;
+    header.clusterHash = clusterHash;
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+        && fwrite(cellSet.data(), sizeof(cellSet[0]), cellSet.size(), fp) == cellSet.size()
+        && fwrite(sets.data(), sizeof(sets[0]), sets.size(), fp) == sets.size();
+    ok = fclose(fp) == 0 && ok;
+
+    std::error_code err;
+    if (ok) std::filesystem::rename(tmpPath, path, err);
+    if (!ok || err) std::filesystem::remove(tmpPath, err);
+    return ok && !err;
+}
+
+bool PotentiallyVisibleSet::load(const std::filesystem::path &relativePath)
+{
+    std::filesystem::path path = dataPath(relativePath);
+    MappedFile file(path.string().c_str());
+    if (!file) return false;
+
+    // check header and sizes before touching anything
+    PVSHeader header;
+    if (file.size < sizeof(header)) return false;
+    memcpy(&header, file.begin(), sizeof(header));
+    if (memcmp(header.magic, "PVSB", 4) != 0 || header.version != PVS_VERSION) return false;
+    if (header.cellsX < 0 || header.cellsY < 0 || header.numClusters < 0 || header.numSets < 0)
+        return false;
+    size_t words = (size_t(header.numClusters) + 31) / 32;
+    size_t numCells = size_t(header.cellsX) * header.cellsY;
+    if (file.size != sizeof(header) + numCells * sizeof(int32_t)
+        + size_t(header.numSets) * words * sizeof(uint32_t))
+        return false;
+
+    cellsX = header.cellsX;
+    cellsY = header.cellsY;
+    numClusters = header.numClusters;
+    wordsPerSet = int(words);
+    origin = header.origin;
+    cellSize = header.cellSize;
+    clusterHash = header.clusterHash;
+    const char *pos = file.begin() + sizeof(header);
+    cellSet.resize(numCells);
+    memcpy(cellSet.data(), pos, numCells * sizeof(int32_t));
+    sets.resize(size_t(header.numSets) * words);
+    memcpy(sets.data(), pos + numCells * sizeof(int32_t), sets.size() * sizeof(uint32_t));
+
+    // drop any cell pointing past the sets
+    for (auto &set : cellSet)
+        if (set >= header.numSets) set = -1;
+    return true;
+}
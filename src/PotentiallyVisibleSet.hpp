@@ -0,0 +1,51 @@
+// precomputed sets of clusters visible from each cell of walkable space
+#pragma once
+
+#include "MeshData.hpp"
+#include <glm/glm.hpp>
+#include <filesystem>
+#include <vector>
+#include <stdint.h>
+
+class PotentiallyVisibleSet {
+public:
+    // grid of square cells in x and y, each covering all heights
+    glm::vec2 origin;               // corner of cell 0
+    float cellSize;
+    int cellsX, cellsY;
+
+    // clusters of all meshes, numbered in mesh order
+    int numClusters;
+    uint64_t clusterHash;           // from hashClusters, to match against the scene
+
+private:
+    int wordsPerSet;                // 32 clusters per word
+    std::vector<int32_t> cellSet;   // index into sets for each cell, -1 for none
+    std::vector<uint32_t> sets;     // distinct visibility bitsets
+
+public:
+    PotentiallyVisibleSet();
+
+    // find the clusters visible from eye height above each floor in each cell
+    // by tracing rays through the navmesh, which must have its BVH built
+    void bake(const std::vector<MeshData> &meshes, const class NavMesh &navmesh,
+        float cellSize, class ThreadPool &pool);
+
+    // save or load the baked sets, relative paths from the data directory
+    // return false on any failure
+    bool save(const std::filesystem::path &path) const;
+    bool load(const std::filesystem::path &path);
+
+    // true if nothing is baked or loaded
+    bool empty() const { return cellSet.empty(); }
+
+    // visibility bits for the cell containing a position, or null if unknown there
+    const uint32_t *cellBits(const glm::vec3 &position) const;
+
+    // bytes of visibility data
+    size_t bytes() const { return cellSet.size() * sizeof(cellSet[0]) + sets.size() * sizeof(sets[0]); }
+
+    // hash of cluster bounds, continuing from an earlier hash for more clusters
+    static uint64_t hashClusters(const std::vector<MeshCluster> &clusters,
+        uint64_t hash = 14695981039346656037ull);
+};
@@ -0,0 +1,147 @@
+// per-frame list of object draws, sorted to reduce GL state changes
+
+#include "RenderQueue.hpp"
+#include "Object.hpp"
+#include "GLapp.hpp"
+#include "GLState.hpp"
+#include "UniformRing.hpp"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <stdio.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+void RenderQueue::add(Object *object, const GLapp *app)
+{
+    // distance from viewer to object center, quantized so nearer draws first
+    vec3 center = 0.5f * (object->boundsMin + object->boundsMax);
+    vec3 world = vec3(object->objectShaderData.WorldFromModel * vec4(center, 1));
+    float depth = clamp(length(world - app->position) / app->far, 0.f, 1.f);
+
+    // only the texture units the program uses matter
+    std::array<unsigned int, 4> textures = {0, 0, 0, 0};
+    for (int i=0; i < Object::NUM_TEXTURES; ++i)
+        if (!Object::useVariants || object->hasMap(i))
+            textures[i] = object->textureIDs[i];
+    uint32_t textureSet = textureSets.emplace(textures, uint32_t(textureSets.size())).first->second;
+
+    unsigned int program = object->currentProgram()->id;
+    uint64_t key = uint64_t(program & 0xfff) << 52
+        | uint64_t(textureSet & 0xfffff) << 32
+        | uint64_t(object->varrayID & 0xffff) << 16
+        | uint64_t(depth * 0xffff);
+    draws.push_back(Draw{key, object, program, textureSet});
+}
+
+void RenderQueue::submit(GLapp *app, double now, bool sorted)
+{
+    stats = Stats{0, 0, 0, 0, 0};
+
+    // in load order, each object sets all of its own state
+    // count changes from one draw to the next, whether or not GL sees them
+    if (!sorted) {
+        unsigned int program = 0, varray = 0, textures[Object::NUM_TEXTURES] = {0};
+        for (auto &draw : draws) {
+            Object *object = draw.object;
+            if (!object->currentProgram()->id) continue;
+            object->draw(app, now);
+            ++stats.drawCalls;
+            if (object->currentProgram()->id != program) ++stats.programChanges;
+            if (object->varrayID != varray) ++stats.vertexArrayChanges;
+            program = object->currentProgram()->id;
+            varray = object->varrayID;
+            for (int i=0; i < Object::NUM_TEXTURES; ++i)
+                if ((!Object::useVariants || object->hasMap(i)) && object->textureIDs[i] != textures[i]) {
+                    textures[i] = object->textureIDs[i];
+                    ++stats.textureChanges;
+                }
+        }
+        return;
+    }
+
+    std::sort(draws.begin(), draws.end(), [](const Draw &a, const Draw &b) {
+        return a.key < b.key;
+    });
+    buildBatches();
+
+    // scene uniforms are the same for every draw
+    GLState &state = GLState::global();
+    state.bindBufferRange(0, app->uniforms->id(), app->sceneUniformsOffset, sizeof(GLapp::SceneShaderData));
+
+    // only bind what differs from the previous draw
+    // the state layer skips binds, but whole texture sets can be skipped here
+    uint32_t textureSet = ~uint32_t(0);
+    auto batch = batches.begin();
+    for (size_t d=0; d < draws.size(); ++d) {
+        const Draw &draw = draws[d];
+        Object *object = draw.object;
+        bool batched = batch != batches.end() && batch->firstDraw == d;
+        unsigned int drawProgram = object->currentProgram()->id;
+        if (!drawProgram) continue;
+
+        if (state.useProgram(drawProgram))
+            ++stats.programChanges;
+        if (draw.textureSet != textureSet) {
+            stats.textureChanges += object->bindTextures();
+            textureSet = draw.textureSet;
+        }
+        if (state.bindVertexArray(object->varrayID))
+            ++stats.vertexArrayChanges;
+
+        // the whole batch, from the first object's state
+        if (batched) {
+            size_t count = batch->endCommand - batch->firstCommand;
+            stats.drawCalls += GeometryPool::global().draw(batch->firstCommand, count);
+            stats.indirectCommands += int(count);
+            d = batch->endDraw - 1;
+            ++batch;
+            continue;
+        }
+
+        object->setObjectState(app, now);
+        object->drawElements();
+        ++stats.drawCalls;
+    }
+}
+
+void RenderQueue::buildBatches()
+{
+    GeometryPool &pool = GeometryPool::global();
+    batches.clear();
+    commands.clear();
+    commandObjects.clear();
+
+    // runs of pooled draws with the same program and texture set
+    // conditional draws stay separate, since each has its own query
+    for (size_t d=0; d < draws.size(); ++d) {
+        Object *object = draws[d].object;
+        if (!object->usesObjectTexels() || object->occlusionQuery
+            || !object->currentProgram()->id) continue;
+        const Draw &first = draws[batches.empty() ? d : batches.back().firstDraw];
+        if (batches.empty() || batches.back().endDraw != d
+            || first.program != draws[d].program || first.textureSet != draws[d].textureSet)
+            batches.push_back(Batch{d, d, commands.size(), commands.size()});
+
+        // one command per visible cluster range
+        for (size_t r=0; r < object->drawCounts.size(); ++r) {
+            uint32_t drawNumber = pool.multiDraw ? uint32_t(commands.size()) : 0;
+            commands.push_back(GeometryPool::DrawCommand{
+                uint32_t(object->drawCounts[r]), 1,
+                uint32_t(size_t(object->drawOffsets[r]) / sizeof(unsigned int)),
+                object->baseVertex, drawNumber});
+            commandObjects.push_back(object->uniformsOffset);
+        }
+        batches.back().endDraw = d + 1;
+        batches.back().endCommand = commands.size();
+    }
+    pool.setCommands(commands, commandObjects);
+}
+
+void RenderQueue::report(const char *label) const
+{
+    printf("%s: %d draws (%d indirect commands), %d program, %d texture, %d vertex array changes per frame\n",
+        label, stats.drawCalls, stats.indirectCommands, stats.programChanges, stats.textureChanges,
+        stats.vertexArrayChanges);
+}
@@ -0,0 +1,67 @@
+// per-frame list of object draws, sorted to reduce GL state changes
+#pragma once
+
+#include "GeometryPool.hpp"
+#include <vector>
+#include <map>
+#include <array>
+#include <stdint.h>
+
+class RenderQueue {
+public:
+    // one object draw and its sort key
+    // key bits, most to least significant: program, texture set, VAO, depth
+    // the key masks program and texture set, so it only orders draws;
+    // the full values decide what draws can share state
+    struct Draw {
+        uint64_t key;
+        class Object *object;
+        unsigned int program;
+        uint32_t textureSet;
+    };
+    std::vector<Draw> draws;
+
+    // counts for the last submitted frame
+    struct Stats {
+        int drawCalls;
+        int programChanges;
+        int textureChanges;         // texture units rebound
+        int vertexArrayChanges;
+        int indirectCommands;       // draws within indirect draw calls
+    } stats;
+
+private:
+    // small stable numbers for each distinct set of textures
+    std::map<std::array<unsigned int, 4>, uint32_t> textureSets;
+
+    // sorted pooled draws sharing program and textures, drawn together
+    struct Batch {
+        size_t firstDraw, endDraw;
+        size_t firstCommand, endCommand;
+    };
+    std::vector<Batch> batches;
+    std::vector<GeometryPool::DrawCommand> commands;
+    std::vector<size_t> commandObjects;     // object data offset for each command
+
+public:
+    RenderQueue() : stats{0,0,0,0,0} {}
+
+    // start a new frame
+    void clear() { draws.clear(); }
+
+    // add an object to draw this frame, with depth from the app's viewpoint
+    void add(class Object *object, const class GLapp *app);
+
+    // draw everything added since clear
+    // sorted by key, binding only state that changes from draw to draw,
+    // and with pooled objects batched into indirect draws,
+    // otherwise in the order added, with every object setting all its state
+    void submit(class GLapp *app, double now, bool sorted);
+
+    // print stats for the last frame
+    void report(const char *label) const;
+
+private:
+    // group sorted draws into batches and upload their commands
+    void buildBatches();
+};
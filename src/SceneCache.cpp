@@ -0,0 +1,200 @@
+// binary cache of parsed scene data, so later runs can skip parsing
+//
+// Layout, all in native byte order:
+//   CacheHeader
+//   per source file: CacheFile, then path
+//   per mesh: material constants, channels, map names, then vert, norm, uv, indices
+//   navmesh plane, alpha, and beta arrays
+// Strings and arrays are stored as a uint32_t count followed by the data.
+
+#include "SceneCache.hpp"
+#include "NavMesh.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <string>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+using namespace std;  // avoid  on std types and functions
+
+#ifdef _WIN32
+// don't complain if we use standard IO functions instead of windows-only
+#pragma warning( disable: 4996 )
+#endif
+
+// change whenever the layout or loader output changes to invalidate old caches
+static const uint32_t CACHE_VERSION = 2;
+
+struct CacheHeader {
+    char magic[4];                  // "OBJC"
+    uint32_t version;               // CACHE_VERSION
+    uint32_t numFiles;              // obj and mtl files this depends on
+    uint32_t numMeshes;             // number of meshes
+    uint32_t hasNavMesh;            // navmesh arrays are meaningful
+    vec3 BoxMin, BoxMax;            // scene bounds
+};
+
+// source file identity: cache is stale if either changes
+struct CacheFile {
+    uint64_t size;
+    int64_t mtime;
+};
+
+// current identity of a source file
+static bool cacheFileInfo(const filesystem::path &path, CacheFile &info)
+{
+    error_code err;
+    info.size = filesystem::file_size(path, err);
+    if (err) return false;
+    info.mtime = filesystem::last_write_time(path, err).time_since_epoch().count();
+    return !err;
+}
+
+bool saveSceneCache(const filesystem::path &cachePath, const vector<filesystem::path> &sources,
+    const MeshData *meshes, size_t numMeshes, const NavMesh *navmesh, int navBase,
+    vec3 BoxMin, vec3 BoxMax)
+{
+    // write to temporary file, then rename so a partial cache is never seen
+    filesystem::path tmpPath = cachePath;
+    tmpPath += ".tmp";
+    FILE *fp = fopen(tmpPath.string().c_str(), "wb");
+    if (!fp) return false;
+
+    bool ok = true;
+    auto write = [&](const void *data, size_t size) {
+        ok = ok && fwrite(data, 1, size, fp) == size;
+    };
+    auto writeCount = [&](size_t count) {
+        uint32_t count32 = uint32_t(count);
+        write(&count32, sizeof(count32));
+    };
+    auto writeString = [&](const string &str) {
+        writeCount(str.size());
+        write(str.data(), str.size());
+    };
+    auto writeArray = [&](const auto &array, size_t first = 0) {
+        writeCount(array.size() - first);
+        write(array.data() + first, (array.size() - first) * sizeof(array[0]));
+    };
+
+    CacheHeader header = {{'O','B','J','C'}, CACHE_VERSION, uint32_t(sources.size()),
+        uint32_t(numMeshes), navmesh != nullptr, BoxMin, BoxMax};
+    write(&header, sizeof(header));
+
+    for (auto &file : sources) {
+        CacheFile info;
+        ok = ok && cacheFileInfo(file, info);
+        write(&info, sizeof(info));
+        writeString(file.string());
+    }
+
+    for (size_t m=0; m < numMeshes; ++m) {
+        const MaterialData &material = meshes[m].material;
+        write(&material.Ka, sizeof(material.Ka));
+        write(&material.Kd, sizeof(material.Kd));
+        write(&material.Ks, sizeof(material.Ks));
+        write(&material.Ns, sizeof(material.Ns));
+        writeArray(material.channels);
+        for (auto &map : material.maps)
+            writeString(map);
+
+        writeArray(meshes[m].vert);
+        writeArray(meshes[m].norm);
+        writeArray(meshes[m].uv);
+        writeArray(meshes[m].indices);
+    }
+
+    if (navmesh) {
+        writeArray(navmesh->plane, navBase);
+        writeArray(navmesh->alpha, navBase);
+        writeArray(navmesh->beta, navBase);
+    }
+
+    ok = (fclose(fp) == 0) && ok;
+    error_code err;
+    if (ok) filesystem::rename(tmpPath, cachePath, err);
+    if (!ok || err) filesystem::remove(tmpPath, err);
+    return ok && !err;
+}
+
+bool loadSceneCache(const filesystem::path &cachePath, vector<MeshData> &meshes, NavMesh *navmesh,
+    vec3 &BoxMin, vec3 &BoxMax)
+{
+    MappedFile cacheFile(cachePath.string().c_str());
+    if (!cacheFile) return false;
+
+    // sequential reads, failing on truncated data
+    const char *pos = cacheFile.begin();
+    auto read = [&](void *data, size_t size) {
+        if (size > size_t(cacheFile.end() - pos)) return false;
+        memcpy(data, pos, size);
+        pos += size;
+        return true;
+    };
+    auto readString = [&](string &str) {
+        uint32_t count;
+        if (!read(&count, sizeof(count)) || count > size_t(cacheFile.end() - pos)) return false;
+        str.assign(pos, count);
+        pos += count;
+        return true;
+    };
+    auto readArray = [&](auto &array) {
+        uint32_t count;
+        if (!read(&count, sizeof(count))) return false;
+        if (count > (cacheFile.end() - pos) / sizeof(array[0])) return false;
+        array.resize(count);
+        return read(array.data(), count * sizeof(array[0]));
+    };
+
+    // check header and that all source files are unchanged
+    CacheHeader header;
+    if (!read(&header, sizeof(header))) return false;
+    if (memcmp(header.magic, "OBJC", 4) != 0 || header.version != CACHE_VERSION) return false;
+    if (navmesh && !header.hasNavMesh) return false;
+
+    for (uint32_t f=0; f < header.numFiles; ++f) {
+        CacheFile cached, current;
+        string path;
+        if (!read(&cached, sizeof(cached)) || !readString(path)) return false;
+        if (!cacheFileInfo(path, current)) return false;
+        if (cached.size != current.size || cached.mtime != current.mtime) return false;
+    }
+
+    // read everything before touching the outputs
+    vector<MeshData> cached(header.numMeshes);
+    for (auto &mesh : cached) {
+        MaterialData &material = mesh.material;
+        bool ok = read(&material.Ka, sizeof(material.Ka)) && read(&material.Kd, sizeof(material.Kd))
+            && read(&material.Ks, sizeof(material.Ks)) && read(&material.Ns, sizeof(material.Ns))
+            && readArray(material.channels) && material.channels.size() == material.maps.size();
+        for (auto &map : material.maps)
+            ok = ok && readString(map);
+        ok = ok && readArray(mesh.vert) && readArray(mesh.norm)
+            && readArray(mesh.uv) && readArray(mesh.indices);
+        if (!ok) return false;
+    }
+
+    NavMesh cachedNav;
+    if (header.hasNavMesh) {
+        if (!readArray(cachedNav.plane) || !readArray(cachedNav.alpha) || !readArray(cachedNav.beta))
+            return false;
+    }
+
+    // good cache: add to outputs
+    for (auto &mesh : cached)
+        meshes.push_back(move(mesh));
+
+    if (navmesh) {
+        int base = navmesh->reserveTriangles(int(cachedNav.plane.size()));
+        copy(cachedNav.plane.begin(), cachedNav.plane.end(), navmesh->plane.begin() + base);
+        copy(cachedNav.alpha.begin(), cachedNav.alpha.end(), navmesh->alpha.begin() + base);
+        copy(cachedNav.beta.begin(), cachedNav.beta.end(), navmesh->beta.begin() + base);
+    }
+
+    BoxMin = header.BoxMin;
+    BoxMax = header.BoxMax;
+    return true;
+}
@@ -0,0 +1,22 @@
+// binary cache of parsed scene data, so later runs can skip parsing
+#pragma once
+
+#include "MeshData.hpp"
+#include <glm/glm.hpp>
+#include <filesystem>
+#include <vector>
+
+// Save meshes and navmesh triangles from navBase on to cachePath
+// Cache is only valid while all sources files are unchanged
+// Return false on any failure
+bool saveSceneCache(const std::filesystem::path &cachePath,
+    const std::vector<std::filesystem::path> &sources,
+    const MeshData *meshes, size_t numMeshes,
+    const class NavMesh *navmesh, int navBase,
+    glm::vec3 BoxMin, glm::vec3 BoxMax);
+
+// Append cached meshes and navmesh triangles (if navmesh isn't nullptr)
+// Return false without changing anything if cache is missing or out of date
+bool loadSceneCache(const std::filesystem::path &cachePath,
+    std::vector<MeshData> &meshes, class NavMesh *navmesh,
+    glm::vec3 &BoxMin, glm::vec3 &BoxMax);
@@ -0,0 +1,108 @@
+// load a scene in the background, adding objects as they become ready
+#include "SceneLoader.hpp"
+#include "ObjLoad.hpp"
+#include "Object.hpp"
+#include "GLapp.hpp"
+#include "ThreadPool.hpp"
+#include "TextureCache.hpp"
+#include "Shader.hpp"
+
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <stdio.h>
+
+using namespace std;
+
+SceneLoader::SceneLoader(const char *objFileName, unsigned threads, bool useCache)
+    : objFileName(objFileName), threads(threads), useCache(useCache),
+      numMeshes(0), parsed(false), decoded(false), navmeshSent(false), uploaded(0),
+      reported(false)
+{
+    startTime = chrono::high_resolution_clock::now();
+    thread = std::thread(&SceneLoader::load, this);
+}
+
+SceneLoader::~SceneLoader()
+{
+    if (thread.joinable())
+        thread.join();
+}
+
+// everything not needing GL: parse, then decode textures, queueing each
+// mesh for upload as soon as all of its own textures are done
+void SceneLoader::load()
+{
+    ObjParse(objFileName.c_str(), meshes, &navmesh, threads, useCache);
+    navmesh.buildBVH();
+    numMeshes = meshes.size();
+    parsed = true;
+
+    decodeTextures(meshes, ThreadPool::global(), [&](size_t m) {
+        lock_guard<std::mutex> lock(mutex);
+        ready.push_back(m);
+    });
+    decoded = true;
+}
+
+void SceneLoader::update(GLapp &app, double budget)
+{
+    if (reported) return;
+    if (!parsed) {
+        if (title.empty()) {
+            title = "Simple OpenGL Application - loading " + objFileName;
+            glfwSetWindowTitle(app.win, title.c_str());
+        }
+        return;
+    }
+
+    // navmesh is complete once parsed, swap it into the app
+    if (!navmeshSent) {
+        std::swap(*app.navmesh, navmesh);
+        navmeshSent = true;
+    }
+
+    // upload as many ready meshes as fit in the time budget
+    auto frameStart = chrono::high_resolution_clock::now();
+    size_t before = uploaded;
+    for (;;) {
+        size_t m;
+        {
+            lock_guard<std::mutex> lock(mutex);
+            if (ready.empty()) break;
+            m = ready.front();
+            ready.pop_front();
+        }
+        app.objects.push_back(new Object(move(meshes[m])));
+        ++uploaded;
+
+        chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - frameStart;
+        if (elapsed.count() > budget) break;
+    }
+    if (uploaded == before && !done()) return;
+
+    // show progress in window title
+    char buffer[64];
+    if (done()) {
+        title = "Simple OpenGL Application";
+        chrono::duration<float> elapsed = chrono::high_resolution_clock::now() - startTime;
+        cout << objFileName << " fully resident after " << elapsed.count() << " seconds, "
+             << uploaded << " objects\n";
+        TextureCache::global().report();
+        ShaderProgram::report();
+        reported = true;
+        meshes.clear();
+        meshes.shrink_to_fit();
+    }
+    else {
+        snprintf(buffer, sizeof(buffer), " - loading %d%%", int(100 * progress()));
+        title = "Simple OpenGL Application" + string(buffer);
+    }
+    glfwSetWindowTitle(app.win, title.c_str());
+}
+
+float SceneLoader::progress() const
+{
+    if (!parsed) return 0.f;
+    if (numMeshes == 0) return 1.f;
+    return float(uploaded) / float(numMeshes);
+}
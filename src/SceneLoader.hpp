@@ -0,0 +1,57 @@
+// load a scene in the background, adding objects as they become ready
+#pragma once
+
+#include "MeshData.hpp"
+#include "NavMesh.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+class SceneLoader {
+    std::string objFileName;
+    unsigned threads;               // for ObjParse, 0 = shared pool
+    bool useCache;
+
+    std::thread thread;             // runs parse and texture decode
+    std::vector<MeshData> meshes;   // parsed meshes, filled by thread
+    NavMesh navmesh;                // built by thread, handed to app once parsed
+
+    std::mutex mutex;               // protects ready
+    std::deque<size_t> ready;       // meshes with textures decoded, in file order
+
+    size_t numMeshes;               // valid once parsed
+    std::atomic<bool> parsed;       // meshes and navmesh are complete
+    std::atomic<bool> decoded;      // all textures are decoded
+    bool navmeshSent;               // navmesh has been given to app
+    size_t uploaded;                // meshes turned into objects so far
+    std::string title;              // last window title shown
+    bool reported;                  // final load time has been printed
+
+    std::chrono::high_resolution_clock::time_point startTime;
+
+public:
+    // start loading immediately on a separate thread
+    SceneLoader(const char *objFileName, unsigned threads = 0, bool useCache = true);
+
+    // waits for the loading thread to finish
+    ~SceneLoader();
+
+    // call once per frame from the GL thread: upload ready meshes as
+    // objects, stopping after budget seconds (always at least one)
+    void update(class GLapp &app, double budget);
+
+    // fraction of the scene resident on the GPU, 0 until parsing is done
+    float progress() const;
+
+    // true once every object has been added to the app
+    bool done() const { return parsed && decoded && uploaded == numMeshes; }
+
+private:
+    // loading thread main
+    void load();
+};
@@ -1,16 +1,21 @@
 // functions to load shaders
 
 #include "Shader.hpp"
+#include "GLState.hpp"
 #include "config.h"
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include <filesystem>
+#include <algorithm>
+#include <chrono>
 #include <vector>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 #ifdef _WIN32
@@ -18,10 +23,8 @@
 #pragma warning( disable: 4996 )
 #endif
 
-// load and compile a single shader
-// id is an existing shader object
-// shader type is defined by shader object type
-bool loadShader(unsigned int id, const char *file)
+// start compiling a single shader, without waiting for the result
+void submitShader(unsigned int id, const char *file, const std::string &defines)
 {
     // read entire file
     std::filesystem::path path = std::filesystem::path(PROJECT_DATA_DIR) / file;
@@ -34,21 +37,38 @@ bool loadShader(unsigned int id, const char *file)
 #endif
     assert(ok != -1);
 
-    // feed shader to OpenGL as an array of blocks of code with a parallel array of sizes
-    // we're using one block with the entire code file.
-    int shaderBlockSizes[] = {int(statbuf.st_size)};
-    std::vector<GLchar> shader(shaderBlockSizes[0]);
-    GLchar *shaderBlocks[] = {shader.data()};
-
+    std::vector<GLchar> shader(statbuf.st_size);
     FILE *f = fopen(path.string().c_str(), "rb");
     assert(f);
-    fread(shaderBlocks[0], 1, shaderBlockSizes[0], f);
+    fread(shader.data(), 1, shader.size(), f);
     fclose(f);
 
+    // feed shader to OpenGL as an array of blocks of code with a parallel array of sizes
+    // the code file is split after the #version line to insert any defines
+    // #line keeps error messages matching line numbers in the file
+    std::string header;
+    int split = 0;
+    if (!defines.empty()) {
+        std::string code(shader.begin(), shader.end());
+        size_t version = code.find("#version");
+        size_t eol = version == std::string::npos ? version : code.find('\n', version);
+        if (eol != std::string::npos) {
+            split = int(eol + 1);
+            int line = 2 + int(std::count(code.begin(), code.begin() + version, '\n'));
+            header = defines + "#line " + std::to_string(line) + "\n";
+        }
+    }
+    const GLchar *shaderBlocks[] = {shader.data(), header.data(), shader.data() + split};
+    int shaderBlockSizes[] = {split, int(header.size()), int(shader.size()) - split};
+
     // compile as shader
-    glShaderSource(id, 1, shaderBlocks, shaderBlockSizes);
+    glShaderSource(id, 3, shaderBlocks, shaderBlockSizes);
     glCompileShader(id);
+}
 
+// check compile status of a single shader, printing any errors
+bool shaderStatus(unsigned int id)
+{
     // was compile successful?
     GLint success;
     glGetShaderiv(id, GL_COMPILE_STATUS, &success);
@@ -68,19 +88,36 @@ bool loadShader(unsigned int id, const char *file)
     return false;   // failed to compile
 }
 
+// load and compile a single shader
+// id is an existing shader object
+// shader type is defined by shader object type
+bool loadShader(unsigned int id, const char *file, const std::string &defines)
+{
+    submitShader(id, file, defines);
+    return shaderStatus(id);
+}
 
-// load a set of shaders
-bool loadShaders(unsigned int progID, std::vector<ShaderInfo> &components)
+// start compiling and linking a set of shaders, without waiting for the result
+void submitShaders(unsigned int progID, std::vector<ShaderInfo> &components,
+    const std::string &defines)
 {
-    // load shader code
-    for(auto shader : components) {
-        if (! loadShader(shader.id, shader.file)) return false; // bail on error
-    }
+    for(auto shader : components)
+        submitShader(shader.id, shader.file, defines);
 
     // link shader programs
     for(auto shader : components)
         glAttachShader(progID, shader.id);
     glLinkProgram(progID);
+}
+
+// check compile and link status of a set of shaders, printing any errors
+bool programStatus(unsigned int progID, std::vector<ShaderInfo> &components)
+{
+    // any compile errors?
+    bool compiled = true;
+    for(auto shader : components)
+        compiled = shaderStatus(shader.id) && compiled;
+    if (!compiled) return false;
 
     // was link successful?
     GLint success;
@@ -100,3 +137,267 @@ bool loadShaders(unsigned int progID, std::vector<ShaderInfo> &components)
     delete[] infoLog;
     return false;   // failed to link
 }
+
+// load a set of shaders
+bool loadShaders(unsigned int progID, std::vector<ShaderInfo> &components,
+    const std::string &defines)
+{
+    submitShaders(progID, components, defines);
+    return programStatus(progID, components);
+}
+
+
+std::map<ShaderProgram::Key, ShaderProgram*> &ShaderProgram::cache()
+{
+    // never destroyed, so no GL calls happen after the context is gone
+    static auto *programs = new std::map<Key, ShaderProgram*>;
+    return *programs;
+}
+
+ShaderProgram::ShaderProgram(const std::vector<std::string> &files, const std::string &defines,
+    const std::function<void(unsigned int)> &setup)
+    : id(0), pendingID(0), pendingStart(0), files(files), defines(defines), setup(setup)
+{
+}
+
+ShaderProgram *ShaderProgram::get(const std::vector<std::string> &files,
+    const std::string &defines, const std::function<void(unsigned int)> &setup)
+{
+    ShaderProgram *&program = cache()[Key(files, defines)];
+    if (!program) {
+        program = new ShaderProgram(files, defines, setup);
+        program->submit();
+    }
+    return program;
+}
+
+int ShaderProgram::reloadAll()
+{
+    for (auto &program : cache())
+        program.second->submit();
+    return int(cache().size());
+}
+
+int ShaderProgram::pollAll()
+{
+    int pending = 0;
+    for (auto &program : cache())
+        if (program.second->poll()) ++pending;
+    return pending;
+}
+
+double ShaderProgram::totalTime = 0;
+int ShaderProgram::numBuilt = 0, ShaderProgram::numFromBinary = 0;
+
+void ShaderProgram::report()
+{
+    printf("%d shader programs (including variants), %d builds in %g ms, %d from binary cache\n",
+        count(), numBuilt, 1000 * totalTime, numFromBinary);
+}
+
+// FNV-1a hash, continuing from an earlier hash value
+static uint64_t fnv(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (size_t i=0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+static uint64_t fnv(uint64_t hash, const char *string)
+{
+    return fnv(hash, string ? string : "", string ? strlen(string) + 1 : 1);
+}
+
+unsigned long long ShaderProgram::sourceHash() const
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (auto &file : files) {
+        hash = fnv(hash, file.c_str());
+        std::filesystem::path path = std::filesystem::path(PROJECT_DATA_DIR) / file;
+        FILE *f = fopen(path.string().c_str(), "rb");
+        if (!f) continue;
+        char buffer[4096];
+        size_t count;
+        while ((count = fread(buffer, 1, sizeof(buffer), f)) > 0)
+            hash = fnv(hash, buffer, count);
+        fclose(f);
+    }
+    hash = fnv(hash, defines.c_str());
+
+    // binaries are only valid for the driver that made them
+    hash = fnv(hash, (const char*)glGetString(GL_VENDOR));
+    hash = fnv(hash, (const char*)glGetString(GL_RENDERER));
+    hash = fnv(hash, (const char*)glGetString(GL_VERSION));
+    return hash;
+}
+
+// try loading a saved program binary, returning false if missing or rejected
+static bool loadProgramBinary(GLuint progID, const std::filesystem::path &path)
+{
+    FILE *f = fopen(path.string().c_str(), "rb");
+    if (!f) return false;
+
+    // stored as GLenum format then binary data
+    uint32_t format = 0;
+    std::vector<char> binary;
+    if (fread(&format, sizeof(format), 1, f) == 1) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f) - long(sizeof(format));
+        fseek(f, sizeof(format), SEEK_SET);
+        if (size > 0) {
+            binary.resize(size);
+            if (fread(binary.data(), 1, size, f) != size_t(size)) binary.clear();
+        }
+    }
+    fclose(f);
+    if (binary.empty()) return false;
+
+    // driver may reject it, e.g. after an update it doesn't report in GL_VERSION
+    glProgramBinary(progID, format, binary.data(), GLsizei(binary.size()));
+    GLint success;
+    glGetProgramiv(progID, GL_LINK_STATUS, &success);
+    return success;
+}
+
+// save a linked program's binary, ignoring any failure
+static void saveProgramBinary(GLuint progID, const std::filesystem::path &path)
+{
+    GLint size = 0;
+    glGetProgramiv(progID, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) return;
+
+    GLenum format;
+    std::vector<char> binary(size);
+    glGetProgramBinary(progID, size, &size, &format, binary.data());
+    if (size <= 0) return;
+
+    // write to a temporary file then rename, so readers never see a partial file
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    std::filesystem::path tmpPath = path;
+    tmpPath += ".tmp";
+    FILE *f = fopen(tmpPath.string().c_str(), "wb");
+    if (!f) return;
+    uint32_t format32 = format;
+    bool ok = fwrite(&format32, sizeof(format32), 1, f) == 1
+        && fwrite(binary.data(), 1, size, f) == size_t(size);
+    ok = fclose(f) == 0 && ok;
+    if (ok) std::filesystem::rename(tmpPath, path, error);
+    if (!ok || error) std::filesystem::remove(tmpPath, error);
+}
+
+// seconds since some fixed time
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ShaderProgram::submit()
+{
+    // let the driver compile on its own threads, if it can
+    static bool parallel = false, checked = false;
+    if (!checked) {
+        parallel = GLEW_KHR_parallel_shader_compile;
+        if (parallel) glMaxShaderCompilerThreadsKHR(0xffffffffu);
+        checked = true;
+    }
+
+    // drop any earlier build that hasn't finished
+    if (pendingID) {
+        for (auto part : pendingParts)
+            glDeleteShader(part.id);
+        glDeleteProgram(pendingID);
+        pendingParts.clear();
+        pendingID = 0;
+    }
+    pendingStart = now();
+    pendingBinary = binaryPath();
+
+    // saved binary, if the driver supports any binary formats
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    GLuint newID = glCreateProgram();
+    if (numFormats > 0 && loadProgramBinary(newID, pendingBinary)) {
+        install(newID, true);
+        return;
+    }
+
+    // rejected binary leaves the program unlinked, start fresh
+    glDeleteProgram(newID);
+    newID = glCreateProgram();
+    glProgramParameteri(newID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    // shader objects, typed by file extension
+    for (auto &file : files) {
+        std::string extension = std::filesystem::path(file).extension().string();
+        GLenum type = extension == ".frag" || extension == ".fragmentshader"
+            ? GL_FRAGMENT_SHADER : GL_VERTEX_SHADER;
+        pendingParts.push_back(ShaderInfo{glCreateShader(type), file.c_str()});
+    }
+
+    // status is checked later in poll, so all programs can compile at once
+    submitShaders(newID, pendingParts, defines);
+    pendingID = newID;
+}
+
+bool ShaderProgram::poll()
+{
+    if (!pendingID) return false;
+
+    // without the extension, status checks wait, but at least not until the next frame
+    if (GLEW_KHR_parallel_shader_compile) {
+        GLint done = GL_FALSE;
+        glGetProgramiv(pendingID, GL_COMPLETION_STATUS_KHR, &done);
+        if (!done) return true;
+    }
+
+    GLuint newID = pendingID;
+    bool ok = programStatus(newID, pendingParts);
+    for (auto part : pendingParts) {
+        glDetachShader(newID, part.id);
+        glDeleteShader(part.id);
+    }
+    pendingParts.clear();
+    pendingID = 0;
+
+    // keep the old program if this one failed
+    if (!ok) {
+        glDeleteProgram(newID);
+        return false;
+    }
+
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    if (numFormats > 0) saveProgramBinary(newID, pendingBinary);
+    install(newID, false);
+    return false;
+}
+
+std::filesystem::path ShaderProgram::binaryPath() const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", sourceHash());
+    return std::filesystem::path(PROJECT_CACHE_DIR) / name;
+}
+
+void ShaderProgram::install(unsigned int newID, bool fromBinary)
+{
+    // one-time setup, then swap in
+    if (setup) setup(newID);
+    if (id) {
+        glDeleteProgram(id);
+        GLState::global().deletedProgram(id);
+    }
+    id = newID;
+
+    // log time from submit until ready, to compare cold (compiled) and warm (binary) starts
+    double elapsed = now() - pendingStart;
+    totalTime += elapsed;
+    ++numBuilt;
+    if (fromBinary) ++numFromBinary;
+    std::string list;
+    for (auto &file : files) list += (list.empty() ? "" : "+") + file;
+    printf("shader %s%s %s in %g ms\n", list.c_str(), defines.empty() ? "" : " (variant)",
+        fromBinary ? "loaded from binary" : "compiled", 1000 * elapsed);
+}
@@ -2,6 +2,10 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <map>
+#include <functional>
+#include <filesystem>
 
 // info we need to load a single shader
 struct ShaderInfo {
@@ -11,11 +15,91 @@ struct ShaderInfo {
 
 // load shader from file into id = existing shader object
 // shader type is defined by shader object type
+// defines are extra lines inserted after the #version line
 // return false on compile error
-bool loadShader(unsigned int id, const char *file);
+bool loadShader(unsigned int id, const char *file, const std::string &defines = "");
 
 // load a set of shaders
 // progID is the program object
 // components[numComponents] is a list of shader components to link
 // return false on compile error
-bool loadShaders(unsigned int progID, std::vector<ShaderInfo> &components);
+bool loadShaders(unsigned int progID, std::vector<ShaderInfo> &components,
+    const std::string &defines = "");
+
+// deferred versions of loadShader and loadShaders: submit starts the
+// compile and link without waiting, and status checks the result later,
+// printing any errors. Status blocks if the driver isn't done yet.
+void submitShader(unsigned int id, const char *file, const std::string &defines = "");
+bool shaderStatus(unsigned int id);
+void submitShaders(unsigned int progID, std::vector<ShaderInfo> &components,
+    const std::string &defines = "");
+bool programStatus(unsigned int progID, std::vector<ShaderInfo> &components);
+
+// linked program shared by everything using the same shader files and defines
+class ShaderProgram {
+public:
+    unsigned int id;                    // current GL program, 0 until first is ready
+
+private:
+    // program still compiling, swapped in for id once it links
+    unsigned int pendingID;
+    std::vector<ShaderInfo> pendingParts;
+    double pendingStart;                // submit time, in seconds
+    std::filesystem::path pendingBinary; // where to save it, from sources at submit
+
+    std::vector<std::string> files;     // shader type from .vert or .frag extension
+    std::string defines;                // #define lines for this variant
+    std::function<void(unsigned int)> setup; // uniform setup after each link
+
+    typedef std::pair<std::vector<std::string>, std::string> Key;
+    static std::map<Key, ShaderProgram*> &cache();
+
+    // build time for all programs, in seconds, and how many came from binaries
+    static double totalTime;
+    static int numBuilt, numFromBinary;
+
+public:
+    // shared program for these files and defines, compiled on first use
+    // setup is called with each newly linked program, to bind uniform
+    // blocks and samplers once per program rather than once per object
+    // compiles finish in the background: id stays 0 until pollAll swaps it in
+    static ShaderProgram *get(const std::vector<std::string> &files,
+        const std::string &defines = "",
+        const std::function<void(unsigned int)> &setup = nullptr);
+
+    // start recompiling each cached program once, keeping the old
+    // program until the new one is ready, and keeping it if that fails
+    // return number of programs submitted
+    static int reloadAll();
+
+    // swap in any programs that finished compiling, call once per frame
+    // with GL_KHR_parallel_shader_compile, never waits for the driver
+    // return number of programs still pending
+    static int pollAll();
+
+    // number of distinct programs, including all variants
+    static int count() { return int(cache().size()); }
+
+    // print total program build time
+    static void report();
+
+private:
+    ShaderProgram(const std::vector<std::string> &files, const std::string &defines,
+        const std::function<void(unsigned int)> &setup);
+
+    // start building a new program, to be swapped in when ready
+    // uses a saved program binary when one matches the sources and driver
+    void submit();
+
+    // finish pending program if ready, return true if still pending
+    bool poll();
+
+    // set up and swap in a newly linked program
+    void install(unsigned int newID, bool fromBinary);
+
+    // hash of everything that affects the compiled program
+    unsigned long long sourceHash() const;
+
+    // saved binary file for the current sources and driver
+    std::filesystem::path binaryPath() const;
+};
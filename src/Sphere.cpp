@@ -18,8 +18,20 @@ using namespace glm;  // avoid glm:: for all glm types and functions
 
 // load the sphere data
 Sphere::Sphere(int w, int h, vec3 size, std::string texturePPM) :
-    Object(std::vector<std::string>{texturePPM}, std::vector<int>{-1})
+    Object(std::vector<std::string>{texturePPM}, std::vector<int>{-1}),
+    center(0), phase(0)
 {
+    buildMesh(*this, w, h, size);
+    initGPUData();
+}
+
+// build sphere arrays in any object
+void Sphere::buildMesh(Object &object, int w, int h, vec3 size)
+{
+    std::vector<vec3> &vert = object.vert, &norm = object.norm;
+    std::vector<vec2> &uv = object.uv;
+    std::vector<unsigned int> &indices = object.indices;
+
     // build vertex, normal and texture coordinate arrays
     // * x & y are longitude and latitude grid positions
     for(unsigned int y=0;  y <= h;  ++y) {
@@ -54,23 +66,21 @@ Sphere::Sphere(int w, int h, vec3 size, std::string texturePPM) :
             indices.push_back((w+1)*(y+1) + x);
         }
     }
-
-    initGPUData();
 }
 
 //
 // this is called every time the sphere needs to be redrawn 
 //
-void Sphere::setRenderState(GLapp *app, double now)
+void Sphere::update(GLapp *app, double now)
 {
-    // inherit parent's draw settings
-    Object::setRenderState(app, now);
-
     // update model position
-    objectShaderData.WorldFromModel = translate(mat4(1), 100.f * vec3(cosf(now), sinf(now), 1));
+    objectShaderData.WorldFromModel = animate(center, phase, now);
     objectShaderData.ModelFromWorld = inverse(objectShaderData.WorldFromModel);
+}
 
-    glBindBufferBase(GL_UNIFORM_BUFFER, 1, bufferIDs[OBJECT_UNIFORM_BUFFER]);
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ObjectShaderData), &objectShaderData);
+mat4 Sphere::animate(vec3 center, float phase, double now)
+{
+    float t = float(now) + phase;
+    return translate(mat4(1), center + 100.f * vec3(cosf(t), sinf(t), 1));
 }
 
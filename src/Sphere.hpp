@@ -5,10 +5,20 @@
 
 // sphere object
 class Sphere : public Object {
+public:
+    glm::vec3 center;       // middle of its circular path
+    float phase;            // radians along the path at time 0
+
 public:
     // create sphere given latitude and longitude sizes and color texture
     Sphere(int width, int height, glm::vec3 size, std::string texturePPM);
 
-    // update render state, overridden to move object around
-    virtual void setRenderState(GLapp *app, double now) override;
+    // update per-object data, overridden to move object around
+    virtual void update(GLapp *app, double now) override;
+
+    // fill an object's vertex and index arrays with a sphere mesh
+    static void buildMesh(Object &object, int width, int height, glm::vec3 size);
+
+    // transform for a sphere moving around center at a given time
+    static glm::mat4 animate(glm::vec3 center, float phase, double now);
 };
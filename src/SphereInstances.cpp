@@ -0,0 +1,39 @@
+// many moving spheres, drawn as instances of one sphere mesh
+
+#include "SphereInstances.hpp"
+#include "Sphere.hpp"
+
+#include <math.h>
+#include <assert.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+SphereInstances::SphereInstances(int w, int h, vec3 size, std::string texturePPM,
+    const std::vector<vec3> &centers, const std::vector<float> &phases) :
+    InstancedObject(std::vector<std::string>{texturePPM}, std::vector<int>{-1}),
+    centers(centers), phases(phases)
+{
+    assert(centers.size() == phases.size());
+    Sphere::buildMesh(*this, w, h, size);
+
+    // hue from phase, so neighbors moving differently look different
+    for (float phase : phases) {
+        vec3 hue = 0.5f + 0.5f * cos(phase + vec3(0, 2.0944f, 4.1888f));
+        instances.push_back(Instance{mat4(1), vec4(hue, 1)});
+    }
+
+    initGPUData();
+    animate(0);
+}
+
+void SphereInstances::update(GLapp *app, double now)
+{
+    animate(now);
+}
+
+void SphereInstances::animate(double now)
+{
+    for (size_t i=0; i < instances.size(); ++i)
+        instances[i].ModelFromInstance = Sphere::animate(centers[i], phases[i], now);
+    uploadInstances();
+}
@@ -0,0 +1,26 @@
+// many moving spheres, drawn as instances of one sphere mesh
+#pragma once
+
+#include "InstancedObject.hpp"
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+
+class SphereInstances : public InstancedObject {
+public:
+    // path center and phase of each instance, animated as in Sphere
+    std::vector<glm::vec3> centers;
+    std::vector<float> phases;
+
+public:
+    // one sphere mesh drawn once per center, colored by phase
+    SphereInstances(int width, int height, glm::vec3 size, std::string texturePPM,
+        const std::vector<glm::vec3> &centers, const std::vector<float> &phases);
+
+    // move every instance, then upload them all at once
+    virtual void update(class GLapp *app, double now) override;
+
+private:
+    // set every instance transform for a time, and upload them
+    void animate(double now);
+};
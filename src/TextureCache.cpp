@@ -0,0 +1,128 @@
+// shared GL textures, loaded once per image file and channel
+
+#include "TextureCache.hpp"
+#include "Image.hpp"
+#include "GLState.hpp"
+#include "config.h"
+
+#include <GL/glew.h>
+
+#include <filesystem>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+TextureCache &TextureCache::global()
+{
+    // never destroyed, so no GL calls happen after the context is gone
+    static TextureCache *cache = new TextureCache;
+    return *cache;
+}
+
+unsigned int TextureCache::acquire(const std::string &imagefile, int channel, const Image *image)
+{
+    if (imagefile.empty()) return placeholder();
+
+    // same path resolution as Image, so different spellings share
+    std::filesystem::path path(imagefile);
+    if (path.is_relative()) path = std::filesystem::path(PROJECT_DATA_DIR) / path;
+    Key key(path.lexically_normal().string(), channel);
+
+    auto found = entries.find(key);
+    if (found != entries.end()) {
+        ++found->second.refs;
+        ++hits;
+        return found->second.id;
+    }
+
+    // first use: load into a new texture
+    ++misses;
+    Entry entry = {0, 1, 0, 0};
+    glGenTextures(1, &entry.id);
+    if (image)
+        upload(*image, entry);
+    else
+        upload(Image(imagefile, channel), entry);
+    residentBytes += entry.bytes;
+    savedBytes += entry.saved;
+
+    entries[key] = entry;
+    keys[entry.id] = key;
+    return entry.id;
+}
+
+unsigned int TextureCache::placeholder()
+{
+    if (!placeholderID) {
+        glGenTextures(1, &placeholderID);
+        GLState::global().bindTexture(0, placeholderID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    }
+    return placeholderID;
+}
+
+void TextureCache::release(unsigned int id)
+{
+    auto key = keys.find(id);
+    if (key == keys.end()) return;      // placeholder or never acquired
+
+    auto entry = entries.find(key->second);
+    assert(entry != entries.end() && entry->second.refs > 0);
+    if (--entry->second.refs == 0) {
+        glDeleteTextures(1, &id);
+        GLState::global().deletedTexture(id);
+        residentBytes -= entry->second.bytes;
+        savedBytes -= entry->second.saved;
+        entries.erase(entry);
+        keys.erase(key);
+    }
+}
+
+void TextureCache::report() const
+{
+    printf("texture cache: %d hits, %d misses, %d textures resident\n",
+        hits, misses, int(entries.size()));
+    printf("  %.2f MB texture memory, %.2f MB saved by single-channel maps\n",
+        residentBytes / (1024.f * 1024.f), savedBytes / (1024.f * 1024.f));
+}
+
+void TextureCache::upload(const Image &image, Entry &entry)
+{
+    // copy into a freshly orphaned pixel buffer, so the driver can transfer
+    // from it while we go on, without waiting for earlier uploads
+    size_t bytes = image.pixels.size();
+    if (!unpackBuffer) glGenBuffers(1, &unpackBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpackBuffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    const void *pixels = nullptr;       // offset 0 in the pixel buffer
+    if (staging) {
+        memcpy(staging, image.pixels.data(), bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    else {                              // map failed, upload from memory
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        pixels = image.pixels.data();
+    }
+
+    // rows are tightly packed, not padded to 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    GLState::global().bindTexture(0, entry.id);
+    if (image.components == 1) {
+        // one channel: replicate on read so shaders can still use .rgb
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, image.width, image.height, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
+        GLint swizzle[] = {GL_RED, GL_RED, GL_RED, GL_ONE};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // full mipmap chain adds about 1/3, RGB is typically padded to 4 bytes
+    size_t texels = size_t(image.width) * image.height * 4 / 3;
+    entry.bytes = texels * (image.components == 1 ? 1 : 4);
+    entry.saved = image.components == 1 ? texels * 3 : 0;
+}
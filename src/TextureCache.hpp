@@ -0,0 +1,54 @@
+// shared GL textures, loaded once per image file and channel
+#pragma once
+
+#include <map>
+#include <string>
+#include <utility>
+
+class TextureCache {
+    // one GL texture and the number of objects using it
+    struct Entry {
+        unsigned int id;
+        int refs;
+        size_t bytes;                           // GPU memory, including mipmaps
+        size_t saved;                           // less than it would be as RGB
+    };
+    typedef std::pair<std::string, int> Key;    // resolved path and channel
+
+    std::map<Key, Entry> entries;
+    std::map<unsigned int, Key> keys;           // back from texture ID to entry
+    unsigned int placeholderID;                 // shared 1x1 texture, 0 until needed
+    unsigned int unpackBuffer;                  // staging pixel buffer, 0 until needed
+
+public:
+    int hits, misses;                           // acquire calls found or loaded
+    size_t residentBytes;                       // GPU memory for cached textures
+    size_t savedBytes;                          // saved by single-channel storage
+
+public:
+    TextureCache() : placeholderID(0), unpackBuffer(0), hits(0), misses(0),
+        residentBytes(0), savedBytes(0) {}
+
+    // cache used by all objects
+    static TextureCache &global();
+
+    // texture for an image file and channel, adding a reference
+    // on first use, uploads image if given, otherwise loads the file
+    // channel is -1 for use all channels, 0 for red, 1 for green, or 2 for blue
+    unsigned int acquire(const std::string &imagefile, int channel = -1,
+        const class Image *image = nullptr);
+
+    // shared 1x1 texture, which the shader treats as missing
+    unsigned int placeholder();
+
+    // drop a reference from acquire, deleting the texture when unused
+    void release(unsigned int id);
+
+    // print hit and miss counts and texture memory
+    void report() const;
+
+private:
+    // load decoded image into a texture object through the staging buffer
+    // single-channel images are stored as GL_R8, read in shaders as (r,r,r,1)
+    void upload(const class Image &image, Entry &entry);
+};
@@ -0,0 +1,86 @@
+// pool of worker threads for data-parallel loops
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(unsigned threads) : stop(false)
+{
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    for (unsigned i=1; i < threads; ++i)   // caller is the last thread
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+ThreadPool &ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::runTasks(Job &job)
+{
+    for (int i; (i = job.next++) < job.count; )
+        (*job.task)(i);
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)> &task)
+{
+    if (count <= 0) return;
+
+    // not worth waking anyone for one task
+    if (count == 1 || workers.empty()) {
+        for (int i=0; i < count; ++i) task(i);
+        return;
+    }
+
+    Job job;
+    job.task = &task;
+    job.count = count;
+    job.next = 0;
+    job.active = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(&job);
+    }
+    wake.notify_all();
+
+    // help out, then wait for workers still running tasks from this job
+    // once off the list, no new workers can pick it up
+    runTasks(job);
+    std::unique_lock<std::mutex> lock(mutex);
+    for (auto it = jobs.begin(); it != jobs.end(); ++it)
+        if (*it == &job) { jobs.erase(it); break; }
+    finished.wait(lock, [&]{ return job.active == 0; });
+}
+
+void ThreadPool::workerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&]{ return stop || !jobs.empty(); });
+        if (stop) return;
+
+        // take tasks from oldest job; retire it once all are claimed
+        Job *job = jobs.front();
+        if (job->next >= job->count) {
+            jobs.pop_front();
+            continue;
+        }
+
+        ++job->active;
+        lock.unlock();
+        runTasks(*job);
+        lock.lock();
+        if (--job->active == 0) finished.notify_all();
+    }
+}
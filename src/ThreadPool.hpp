@@ -0,0 +1,50 @@
+// pool of worker threads for data-parallel loops
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <deque>
+
+class ThreadPool {
+    // one parallelFor call: workers claim indices until all are taken
+    struct Job {
+        const std::function<void(int)> *task;
+        int count;
+        std::atomic<int> next;      // next index to claim
+        int active;                 // workers using this job, under mutex
+    };
+
+    std::vector<std::thread> workers;
+    std::deque<Job*> jobs;          // jobs with indices left to claim
+    std::mutex mutex;               // protects jobs and stop
+    std::condition_variable wake;   // signal workers there is work
+    std::condition_variable finished; // signal callers a job is done
+    bool stop;
+
+public:
+    // start threads: 0 = one per hardware thread
+    ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    // number of threads that can run tasks, including the caller
+    unsigned size() const { return unsigned(workers.size()) + 1; }
+
+    // run task(i) for each i in [0,count), returning when all are done
+    // the calling thread also runs tasks, so this is safe to call
+    // from several threads at once, or from inside another task
+    void parallelFor(int count, const std::function<void(int)> &task);
+
+    // shared pool for the whole application
+    static ThreadPool &global();
+
+private:
+    // claim and run tasks from job until none are left
+    static void runTasks(Job &job);
+
+    // worker thread main loop
+    void workerLoop();
+};
@@ -0,0 +1,82 @@
+// per-frame uniform data packed into one buffer, written once per frame
+
+#include "UniformRing.hpp"
+#include "GLState.hpp"
+
+#include <GL/glew.h>
+
+#include <string.h>
+#include <assert.h>
+
+UniformRing::UniformRing()
+    : buffer(0), regionSize(0), alignment(256), region(0), mapped(nullptr), used(0)
+{
+    GLint align = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    if (align > 0) alignment = align;
+    for (auto &fence : fences) fence = nullptr;
+    glGenBuffers(1, &buffer);
+}
+
+UniformRing::~UniformRing()
+{
+    for (auto fence : fences)
+        if (fence) glDeleteSync(fence);
+    glDeleteBuffers(1, &buffer);
+    GLState::global().deletedBuffer(buffer);
+}
+
+void UniformRing::map(size_t bytes)
+{
+    assert(!mapped);
+    region = (region + 1) % FRAMES;
+
+    // grow: all regions are replaced, so old fences no longer matter
+    if (bytes > regionSize) {
+        regionSize = aligned(bytes + bytes / 2);
+        for (auto &fence : fences) {
+            if (fence) glDeleteSync(fence);
+            fence = nullptr;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, regionSize * FRAMES, nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    // wait until the GPU is done with this region
+    if (fences[region]) {
+        while (glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(fences[region]);
+        fences[region] = nullptr;
+    }
+
+    // fence makes this safe without driver synchronization
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, region * regionSize, regionSize,
+        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    assert(mapped);
+    used = 0;
+}
+
+size_t UniformRing::push(const void *data, size_t size)
+{
+    assert(mapped && used + size <= regionSize);
+    size_t offset = used;
+    memcpy(mapped + offset, data, size);
+    used = aligned(offset + size);
+    return region * regionSize + offset;
+}
+
+void UniformRing::unmap()
+{
+    assert(mapped);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    mapped = nullptr;
+}
+
+void UniformRing::fence()
+{
+    if (fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
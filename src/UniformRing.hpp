@@ -0,0 +1,44 @@
+// per-frame uniform data packed into one buffer, written once per frame
+#pragma once
+
+#include <stddef.h>
+
+// The buffer holds FRAMES regions used in turn, each guarded by a fence,
+// so the CPU never writes a region the GPU may still be reading.
+class UniformRing {
+public:
+    enum { FRAMES = 3 };
+
+private:
+    unsigned int buffer;            // GL buffer with FRAMES regions
+    size_t regionSize;              // bytes per region
+    size_t alignment;               // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    int region;                     // region for current frame
+    struct __GLsync *fences[FRAMES]; // signaled when GPU is done with region
+    unsigned char *mapped;          // current region while mapped
+    size_t used;                    // bytes written to current region
+
+public:
+    UniformRing();
+    ~UniformRing();
+
+    // GL buffer to bind ranges from
+    unsigned int id() const { return buffer; }
+
+    // round size up to a multiple of the offset alignment
+    size_t aligned(size_t size) const { return (size + alignment - 1) / alignment * alignment; }
+
+    // start writing the next region, with room for at least bytes
+    // bytes should include alignment padding, see aligned
+    // waits only if the GPU is still using that region from FRAMES frames ago
+    void map(size_t bytes);
+
+    // copy data into the current region, returning its buffer offset
+    size_t push(const void *data, size_t size);
+
+    // finish writing the current region
+    void unmap();
+
+    // call after the last draw that uses the current region
+    void fence();
+};
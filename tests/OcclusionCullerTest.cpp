@@ -0,0 +1,180 @@
+// checks for the CPU occlusion culler, with no GL context needed
+
+#include "OcclusionCuller.hpp"
+#include "ThreadPool.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <math.h>
+
+using namespace glm;  // avoid glm:: for all glm types and functions
+
+static int failures = 0;
+
+// report a failed check without stopping, so one run shows every failure
+#define CHECK(cond) \
+    do { if (!(cond)) { fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++failures; } } while (0)
+
+// looking down -z from the origin, 90 degree vertical field of view
+// matching the default 256x128 depth buffer
+static mat4 viewProjection()
+{
+    return perspective(radians(90.f), 2.f, 1.f, 100.f)
+        * lookAt(vec3(0), vec3(0, 0, -1), vec3(0, 1, 0));
+}
+
+// 4x4 quad at z = -10, covering pixels x in [115.2,140.8], y in [51.2,76.8]
+static void addQuad(OcclusionCuller &culler)
+{
+    std::vector<vec3> vert = {{-2,-2,-10}, {2,-2,-10}, {2,2,-10}, {-2,2,-10}};
+    std::vector<unsigned int> indices = {0,1,2, 0,2,3};
+    culler.addOccluders(vert, indices, mat4(1));
+}
+
+// depth buffer holds the quad's depth only where it covers whole pixels
+static void testQuadDepth(ThreadPool &pool)
+{
+    mat4 ProjFromWorld = viewProjection();
+    OcclusionCuller culler;
+    addQuad(culler);
+    culler.render(ProjFromWorld, pool);
+    CHECK(culler.stats.occluders == 1);     // both triangles as one quad
+
+    vec4 clip = ProjFromWorld * vec4(0, 0, -10, 1);
+    float quadDepth = clip.z / clip.w * 0.5f + 0.5f;
+
+    // fully covered pixels, including the ones along the diagonal both triangles share
+    CHECK(fabsf(culler.depth(128, 64) - quadDepth) < 1e-5f);
+    CHECK(fabsf(culler.depth(116, 52) - quadDepth) < 1e-5f);
+    CHECK(fabsf(culler.depth(139, 75) - quadDepth) < 1e-5f);
+
+    // partly covered pixels at the quad's edges, and pixels outside it
+    CHECK(culler.depth(115, 64) == 1.f);
+    CHECK(culler.depth(140, 64) == 1.f);
+    CHECK(culler.depth(128, 51) == 1.f);
+    CHECK(culler.depth(128, 76) == 1.f);
+    CHECK(culler.depth(0, 0) == 1.f);
+    CHECK(culler.depth(200, 64) == 1.f);
+}
+
+// boxes behind the quad are hidden, others are not
+static void testBoxes(ThreadPool &pool)
+{
+    OcclusionCuller culler;
+    addQuad(culler);
+    culler.render(viewProjection(), pool);
+
+    culler.clearBoxes();
+    int behind = culler.addBox(vec3(-1, -1, -20), vec3(1, 1, -15), mat4(1));
+    int beside = culler.addBox(vec3(5, -1, -20), vec3(7, 1, -15), mat4(1));
+    int overlapping = culler.addBox(vec3(1, -1, -20), vec3(3, 1, -15), mat4(1));
+    int inFront = culler.addBox(vec3(-1, -1, -8), vec3(1, 1, -5), mat4(1));
+    int skipped = culler.addBox(vec3(-1, -1, -20), vec3(1, 1, -15), mat4(1));
+
+    // a model-space box moved behind the quad
+    int moved = culler.addBox(vec3(-1), vec3(1), translate(mat4(1), vec3(0, 0, -30)));
+
+    std::vector<char> visible(6, 1);
+    visible[skipped] = 0;
+    culler.test(visible, pool);
+    CHECK(!visible[behind]);
+    CHECK(visible[beside]);
+    CHECK(visible[overlapping]);
+    CHECK(visible[inFront]);
+    CHECK(!visible[skipped]);
+    CHECK(!visible[moved]);
+    CHECK(culler.stats.tested == 5);
+    CHECK(culler.stats.occluded == 2);
+}
+
+// a box seen only through a gap narrower than a pixel stays visible
+static void testGap(ThreadPool &pool)
+{
+    // gap of 0.1 units at z = -10 is about 0.64 pixels wide
+    OcclusionCuller culler;
+    std::vector<vec3> vert = {{-2,-2,-10}, {-0.05f,-2,-10}, {-0.05f,2,-10}, {-2,2,-10},
+                              {0.05f,-2,-10}, {2,-2,-10}, {2,2,-10}, {0.05f,2,-10}};
+    std::vector<unsigned int> indices = {0,1,2, 0,2,3, 4,5,6, 4,6,7};
+    culler.addOccluders(vert, indices, mat4(1));
+    culler.render(viewProjection(), pool);
+
+    CHECK(culler.depth(120, 64) < 1.f);
+    CHECK(culler.depth(127, 64) == 1.f);
+    CHECK(culler.depth(128, 64) == 1.f);
+
+    culler.clearBoxes();
+    culler.addBox(vec3(-0.01f, -1, -20), vec3(0.01f, 1, -15), mat4(1));
+    std::vector<char> visible(1, 1);
+    culler.test(visible, pool);
+    CHECK(visible[0]);
+}
+
+// random occluders and boxes give the same depth buffer and results for any pool size
+static void testThreadCounts()
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> random(-1, 1);
+    std::vector<vec3> vert;
+    std::vector<unsigned int> indices;
+    for (int t=0; t < 2000; ++t) {
+        vec3 center(40 * random(rng), 20 * random(rng), -30 + 25 * random(rng));
+        for (int v=0; v < 3; ++v) {
+            indices.push_back(unsigned(vert.size()));
+            vert.push_back(center + 6.f * vec3(random(rng), random(rng), random(rng)));
+        }
+    }
+    std::vector<vec3> boxMin, boxMax;
+    for (int b=0; b < 3000; ++b) {
+        vec3 center(60 * random(rng), 30 * random(rng), -40 + 35 * random(rng));
+        vec3 extent = 0.1f + 2.f * abs(vec3(random(rng), random(rng), random(rng)));
+        boxMin.push_back(center - extent);
+        boxMax.push_back(center + extent);
+    }
+
+    std::vector<float> firstDepth;
+    std::vector<char> firstVisible;
+    for (unsigned threads : {1u, 2u, 4u, 7u}) {
+        ThreadPool pool(threads);
+        OcclusionCuller culler;
+        culler.maxOccluders = 1000;
+        culler.addOccluders(vert, indices, mat4(1));
+        culler.render(viewProjection(), pool);
+
+        culler.clearBoxes();
+        for (size_t b=0; b < boxMin.size(); ++b)
+            culler.addBox(boxMin[b], boxMax[b], mat4(1));
+        std::vector<char> visible(boxMin.size(), 1);
+        culler.test(visible, pool);
+
+        std::vector<float> depth;
+        for (int y=0; y < culler.height; ++y)
+            for (int x=0; x < culler.width; ++x)
+                depth.push_back(culler.depth(x, y));
+
+        if (firstDepth.empty()) {
+            firstDepth = depth;
+            firstVisible = visible;
+            CHECK(culler.stats.occluded > 0 && culler.stats.occluded < culler.stats.tested);
+        }
+        else {
+            CHECK(depth == firstDepth);
+            CHECK(visible == firstVisible);
+        }
+    }
+}
+
+int main()
+{
+    ThreadPool pool(4);
+    testQuadDepth(pool);
+    testBoxes(pool);
+    testGap(pool);
+    testThreadCounts();
+
+    if (failures) fprintf(stderr, "%d checks failed\n", failures);
+    else printf("all checks passed\n");
+    return failures ? 1 : 0;
+}